@@ -0,0 +1,286 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "libxisf.h"
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace LibXISF
+{
+
+static const size_t HugePageSize = 2 * 1024 * 1024;
+
+class MallocAllocator : public Allocator
+{
+public:
+    void* allocate(size_t size) override
+    {
+        void *ptr = std::malloc(size);
+        if(!ptr)
+            throw std::bad_alloc();
+        return ptr;
+    }
+    void deallocate(void *ptr, size_t) override
+    {
+        std::free(ptr);
+    }
+    void* reallocate(void *ptr, size_t, size_t newSize, size_t) override
+    {
+        void *ret = std::realloc(ptr, newSize);
+        if(!ret)
+            throw std::bad_alloc();
+        return ret;
+    }
+};
+
+static std::mutex defaultMutex;
+static std::shared_ptr<Allocator> defaultAllocatorPtr;
+
+static const std::shared_ptr<Allocator>& mallocAllocator()
+{
+    static std::shared_ptr<Allocator> allocator = std::make_shared<MallocAllocator>();
+    return allocator;
+}
+
+void *Allocator::reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used)
+{
+    void *ret = allocate(newSize);
+    if(used)
+        std::memcpy(ret, ptr, std::min(used, newSize));
+    deallocate(ptr, oldSize);
+    return ret;
+}
+
+void Allocator::setDefault(const std::shared_ptr<Allocator> &allocator)
+{
+    std::lock_guard<std::mutex> lock(defaultMutex);
+    defaultAllocatorPtr = allocator;
+}
+
+std::shared_ptr<Allocator> Allocator::defaultAllocator()
+{
+    std::lock_guard<std::mutex> lock(defaultMutex);
+    return defaultAllocatorPtr ? defaultAllocatorPtr : mallocAllocator();
+}
+
+AlignedAllocator::AlignedAllocator(size_t alignment) :
+    _alignment(std::max(alignment, sizeof(void*)))
+{
+    if(_alignment & (_alignment - 1))
+        throw Error("Alignment must be power of two");
+}
+
+void *AlignedAllocator::allocate(size_t size)
+{
+#ifdef _WIN32
+    void *ptr = _aligned_malloc(size, _alignment);
+#else
+    void *ptr = nullptr;
+    if(posix_memalign(&ptr, _alignment, size))
+        ptr = nullptr;
+#endif
+    if(!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void AlignedAllocator::deallocate(void *ptr, size_t)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+HugePageAllocator::HugePageAllocator(size_t threshold) :
+    AlignedAllocator(4096),
+    _threshold(threshold)
+{
+}
+
+#ifdef _WIN32
+void *HugePageAllocator::allocate(size_t size)
+{
+    return AlignedAllocator::allocate(size);
+}
+
+void HugePageAllocator::deallocate(void *ptr, size_t size)
+{
+    AlignedAllocator::deallocate(ptr, size);
+}
+
+void *HugePageAllocator::reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used)
+{
+    return Allocator::reallocate(ptr, oldSize, newSize, used);
+}
+#else
+// round up to whole huge pages so kernel can back whole mapping with them
+static size_t mappingSize(size_t size)
+{
+    return (size + HugePageSize - 1) / HugePageSize * HugePageSize;
+}
+
+void *HugePageAllocator::allocate(size_t size)
+{
+    if(size < _threshold)
+        return AlignedAllocator::allocate(size);
+
+    void *ptr = mmap(nullptr, mappingSize(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, mappingSize(size), MADV_HUGEPAGE);
+#endif
+    return ptr;
+}
+
+void HugePageAllocator::deallocate(void *ptr, size_t size)
+{
+    if(size < _threshold)
+        AlignedAllocator::deallocate(ptr, size);
+    else
+        munmap(ptr, mappingSize(size));
+}
+
+void *HugePageAllocator::reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used)
+{
+    if(oldSize >= _threshold && newSize >= _threshold && mappingSize(oldSize) == mappingSize(newSize))
+        return ptr;
+#ifdef MREMAP_MAYMOVE
+    // move page tables instead of copying data
+    if(oldSize >= _threshold && newSize >= _threshold)
+    {
+        void *ret = mremap(ptr, mappingSize(oldSize), mappingSize(newSize), MREMAP_MAYMOVE);
+        if(ret == MAP_FAILED)
+            throw std::bad_alloc();
+        return ret;
+    }
+#endif
+    return Allocator::reallocate(ptr, oldSize, newSize, used);
+}
+#endif
+
+class BufferPoolPrivate
+{
+public:
+    std::shared_ptr<Allocator> backing;
+    size_t granularity;
+    mutable std::mutex mutex;
+    std::multimap<size_t, void*> free;// cached blocks ordered by size
+    std::unordered_map<void*, size_t> blockSize;// real size of every block handed out
+    size_t allocationCount = 0;
+    size_t cachedSize = 0;
+
+    size_t roundSize(size_t size) const
+    {
+        if(size >= granularity)
+            return (size + granularity - 1) / granularity * granularity;
+
+        size_t rounded = 64;
+        while(rounded < size)
+            rounded *= 2;
+        return rounded;
+    }
+};
+
+BufferPool::BufferPool(const std::shared_ptr<Allocator> &backing, size_t granularity)
+{
+    p = new BufferPoolPrivate;
+    p->backing = backing ? backing : Allocator::defaultAllocator();
+    p->granularity = std::max<size_t>(granularity, 1);
+}
+
+BufferPool::~BufferPool()
+{
+    clear();
+    delete p;
+}
+
+void *BufferPool::allocate(size_t size)
+{
+    size_t rounded = p->roundSize(size);
+    std::lock_guard<std::mutex> lock(p->mutex);
+
+    // reuse block that is large enough but doesn't waste too much memory
+    auto it = p->free.lower_bound(rounded);
+    if(it != p->free.end() && it->first <= rounded + rounded / 2)
+    {
+        void *ptr = it->second;
+        p->cachedSize -= it->first;
+        p->free.erase(it);
+        return ptr;
+    }
+
+    void *ptr = p->backing->allocate(rounded);
+    p->blockSize[ptr] = rounded;
+    p->allocationCount++;
+    return ptr;
+}
+
+void BufferPool::deallocate(void *ptr, size_t)
+{
+    std::lock_guard<std::mutex> lock(p->mutex);
+    size_t size = p->blockSize.at(ptr);
+    p->free.insert({size, ptr});
+    p->cachedSize += size;
+}
+
+void *BufferPool::reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used)
+{
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        if(p->blockSize.at(ptr) >= newSize)
+            return ptr;
+    }
+    return Allocator::reallocate(ptr, oldSize, newSize, used);
+}
+
+void BufferPool::clear()
+{
+    std::lock_guard<std::mutex> lock(p->mutex);
+    for(auto &block : p->free)
+    {
+        p->backing->deallocate(block.second, block.first);
+        p->blockSize.erase(block.second);
+    }
+    p->free.clear();
+    p->cachedSize = 0;
+}
+
+size_t BufferPool::allocationCount() const
+{
+    std::lock_guard<std::mutex> lock(p->mutex);
+    return p->allocationCount;
+}
+
+size_t BufferPool::cachedSize() const
+{
+    std::lock_guard<std::mutex> lock(p->mutex);
+    return p->cachedSize;
+}
+
+}
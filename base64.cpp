@@ -0,0 +1,383 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "base64.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define LIBXISF_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace LibXISF
+{
+
+static const char base64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char hexDigits[] = "0123456789abcdef";
+
+struct DecodeTables
+{
+    // 0xff marks characters outside of alphabet
+    uint8_t base64[256];
+    uint8_t hex[256];
+    DecodeTables()
+    {
+        std::memset(base64, 0xff, sizeof(base64));
+        std::memset(hex, 0, sizeof(hex));
+        for(int i = 0; i < 64; i++)
+            base64[(uint8_t)base64Alphabet[i]] = i;
+        for(int i = 0; i < 10; i++)
+            hex['0' + i] = i;
+        for(int i = 0; i < 6; i++)
+            hex['a' + i] = hex['A' + i] = 10 + i;
+    }
+};
+
+static const DecodeTables decodeTables;
+
+// SIMD kernels process whole blocks and return number of consumed input bytes
+typedef size_t (*EncodeKernel)(const uint8_t *in, size_t size, uint8_t *out);
+typedef size_t (*DecodeKernel)(const uint8_t *in, size_t size, uint8_t *out, size_t outSize);
+
+static size_t noEncodeKernel(const uint8_t*, size_t, uint8_t*) { return 0; }
+static size_t noDecodeKernel(const uint8_t*, size_t, uint8_t*, size_t) { return 0; }
+
+#ifdef LIBXISF_X86_SIMD
+/* base64 kernels follow approach described by Wojciech Muła and Daniel Lemire
+ * in "Faster Base64 Encoding and Decoding Using AVX2 Instructions" */
+__attribute__((target("ssse3")))
+static inline __m128i base64EncodeReshuffle(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i base64EncodeTranslate(__m128i in)
+{
+    const __m128i lut = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    __m128i mask = _mm_cmpgt_epi8(in, _mm_set1_epi8(25));
+    indices = _mm_sub_epi8(indices, mask);
+    return _mm_add_epi8(in, _mm_shuffle_epi8(lut, indices));
+}
+
+// translate characters to sextets, return false when block contain character outside of alphabet
+__attribute__((target("ssse3")))
+static inline bool base64DecodeTranslate(__m128i &str)
+{
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask2F = _mm_set1_epi8(0x2f);
+
+    __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask2F);
+    __m128i loNibbles = _mm_and_si128(str, mask2F);
+    __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+    __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff)
+        return false;
+
+    __m128i eq2F = _mm_cmpeq_epi8(str, mask2F);
+    __m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(eq2F, hiNibbles));
+    str = _mm_add_epi8(str, roll);
+    return true;
+}
+
+// pack 16 sextets into 12 bytes stored at beginning of register
+__attribute__((target("ssse3")))
+static inline __m128i base64DecodeReshuffle(__m128i in)
+{
+    __m128i mergeAbBc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(mergeAbBc, _mm_set1_epi32(0x00011000));
+    return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+__attribute__((target("ssse3")))
+static size_t base64EncodeSSSE3(const uint8_t *in, size_t size, uint8_t *out)
+{
+    size_t consumed = 0;
+    // load 16 bytes but only 12 are used
+    while(size - consumed >= 16)
+    {
+        __m128i str = _mm_loadu_si128((const __m128i*)(in + consumed));
+        str = base64EncodeTranslate(base64EncodeReshuffle(str));
+        _mm_storeu_si128((__m128i*)out, str);
+        consumed += 12;
+        out += 16;
+    }
+    return consumed;
+}
+
+__attribute__((target("ssse3")))
+static size_t base64DecodeSSSE3(const uint8_t *in, size_t size, uint8_t *out, size_t outSize)
+{
+    size_t consumed = 0;
+    // store writes 16 bytes but only 12 are valid
+    while(size - consumed >= 16 && outSize >= 16)
+    {
+        __m128i str = _mm_loadu_si128((const __m128i*)(in + consumed));
+        if(!base64DecodeTranslate(str))
+            break;
+        _mm_storeu_si128((__m128i*)out, base64DecodeReshuffle(str));
+        consumed += 16;
+        out += 12;
+        outSize -= 12;
+    }
+    return consumed;
+}
+
+__attribute__((target("avx2")))
+static size_t base64EncodeAVX2(const uint8_t *in, size_t size, uint8_t *out)
+{
+    size_t consumed = 0;
+    // each lane get its own 12 input bytes
+    while(size - consumed >= 28)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(in + consumed));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(in + consumed + 12));
+        lo = base64EncodeTranslate(base64EncodeReshuffle(lo));
+        hi = base64EncodeTranslate(base64EncodeReshuffle(hi));
+        _mm256_storeu_si256((__m256i*)out, _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+        consumed += 24;
+        out += 32;
+    }
+    return consumed + base64EncodeSSSE3(in + consumed, size - consumed, out);
+}
+
+__attribute__((target("avx2")))
+static size_t base64DecodeAVX2(const uint8_t *in, size_t size, uint8_t *out, size_t outSize)
+{
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask2F = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t consumed = 0;
+    while(size - consumed >= 32 && outSize >= 32)
+    {
+        __m256i str = _mm256_loadu_si256((const __m256i*)(in + consumed));
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask2F);
+        __m256i loNibbles = _mm256_and_si256(str, mask2F);
+        __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+        __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+        if(!_mm256_testz_si256(lo, hi))
+            break;
+
+        __m256i eq2F = _mm256_cmpeq_epi8(str, mask2F);
+        str = _mm256_add_epi8(str, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(eq2F, hiNibbles)));
+        __m256i merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack);
+        // move 12 bytes of upper lane next to 12 bytes of lower lane
+        merged = _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)out, merged);
+        consumed += 32;
+        out += 24;
+        outSize -= 24;
+    }
+    return consumed + base64DecodeSSSE3(in + consumed, size - consumed, out, outSize);
+}
+
+__attribute__((target("ssse3")))
+static size_t hexEncodeSSSE3(const uint8_t *in, size_t size, uint8_t *out)
+{
+    const __m128i digits = _mm_loadu_si128((const __m128i*)hexDigits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t consumed = 0;
+    while(size - consumed >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(in + consumed));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(bytes, mask));
+        _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(out + 16), _mm_unpackhi_epi8(hi, lo));
+        consumed += 16;
+        out += 32;
+    }
+    return consumed;
+}
+
+// convert 16 hex digits to nibbles, return false when some of them is not valid digit
+__attribute__((target("ssse3")))
+static inline bool hexDecodeNibbles(__m128i &str)
+{
+    __m128i digit = _mm_sub_epi8(str, _mm_set1_epi8('0'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(str, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isAlpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    if(_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xffff)
+        return false;
+
+    str = _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_and_si128(isAlpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    return true;
+}
+
+// decoded size is in output bytes, each consume two digits
+__attribute__((target("ssse3")))
+static size_t hexDecodeSSSE3(const uint8_t *in, size_t size, uint8_t *out, size_t)
+{
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t consumed = 0;
+    while(size - consumed >= 16)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(in + consumed * 2));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(in + consumed * 2 + 16));
+        if(!hexDecodeNibbles(lo) || !hexDecodeNibbles(hi))
+            break;
+        lo = _mm_maddubs_epi16(lo, weights);
+        hi = _mm_maddubs_epi16(hi, weights);
+        _mm_storeu_si128((__m128i*)out, _mm_packus_epi16(lo, hi));
+        consumed += 16;
+        out += 16;
+    }
+    return consumed;
+}
+#endif
+
+struct Kernels
+{
+    EncodeKernel base64Encode = noEncodeKernel;
+    DecodeKernel base64Decode = noDecodeKernel;
+    EncodeKernel hexEncode = noEncodeKernel;
+    DecodeKernel hexDecode = noDecodeKernel;
+    Kernels()
+    {
+#ifdef LIBXISF_X86_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("ssse3"))
+        {
+            base64Encode = base64EncodeSSSE3;
+            base64Decode = base64DecodeSSSE3;
+            hexEncode = hexEncodeSSSE3;
+            hexDecode = hexDecodeSSSE3;
+        }
+        if(__builtin_cpu_supports("avx2"))
+        {
+            base64Encode = base64EncodeAVX2;
+            base64Decode = base64DecodeAVX2;
+        }
+#endif
+    }
+};
+
+static const Kernels kernels;
+
+void base64Encode(const char *in, size_t size, char *out)
+{
+    const uint8_t *s = reinterpret_cast<const uint8_t*>(in);
+    uint8_t *o = reinterpret_cast<uint8_t*>(out);
+
+    size_t i = kernels.base64Encode(s, size, o);
+    o += i / 3 * 4;
+    for(; i + 3 <= size; i += 3)
+    {
+        uint32_t v = s[i] << 16 | s[i + 1] << 8 | s[i + 2];
+        *o++ = base64Alphabet[v >> 18 & 0x3f];
+        *o++ = base64Alphabet[v >> 12 & 0x3f];
+        *o++ = base64Alphabet[v >> 6 & 0x3f];
+        *o++ = base64Alphabet[v & 0x3f];
+    }
+
+    if(i < size)
+    {
+        uint32_t v = s[i] << 16 | (i + 1 < size ? s[i + 1] << 8 : 0);
+        *o++ = base64Alphabet[v >> 18 & 0x3f];
+        *o++ = base64Alphabet[v >> 12 & 0x3f];
+        *o++ = i + 1 < size ? base64Alphabet[v >> 6 & 0x3f] : '=';
+        *o++ = '=';
+    }
+}
+
+size_t base64Decode(const char *in, size_t size, char *out, size_t outSize)
+{
+    const uint8_t *s = reinterpret_cast<const uint8_t*>(in);
+    const uint8_t *end = s + size;
+    uint8_t *o = reinterpret_cast<uint8_t*>(out);
+    uint8_t *oend = o + outSize;
+
+    int n = 0;
+    uint8_t c4[4] = {0};
+    while(s < end)
+    {
+        if(n == 0)
+        {
+            size_t consumed = kernels.base64Decode(s, end - s, o, oend - o);
+            s += consumed;
+            o += consumed / 4 * 3;
+        }
+
+        // continue past block that SIMD kernel rejected, for example because of line break,
+        // and until start of next quad so kernel can take over again
+        const uint8_t *blockEnd = std::min(end, s + 16);
+        for(; s < end && (s < blockEnd || n != 0); s++)
+        {
+            uint8_t c = decodeTables.base64[*s];
+            if(c == 0xff)
+                continue;
+
+            c4[n++] = c;
+            if(n == 4)
+            {
+                if(oend - o < 3)
+                    return o - reinterpret_cast<uint8_t*>(out);
+                *o++ = (c4[0] << 2) | (c4[1] >> 4);
+                *o++ = (c4[1] << 4) | (c4[2] >> 2);
+                *o++ = (c4[2] << 6) | c4[3];
+                n = 0;
+            }
+        }
+    }
+
+    if(n > 1 && o < oend)*o++ = (c4[0] << 2) | (c4[1] >> 4);
+    if(n > 2 && o < oend)*o++ = (c4[1] << 4) | (c4[2] >> 2);
+
+    return o - reinterpret_cast<uint8_t*>(out);
+}
+
+void hexEncode(const char *in, size_t size, char *out)
+{
+    const uint8_t *s = reinterpret_cast<const uint8_t*>(in);
+    size_t i = kernels.hexEncode(s, size, reinterpret_cast<uint8_t*>(out));
+    for(; i < size; i++)
+    {
+        out[2 * i + 0] = hexDigits[s[i] >> 4];
+        out[2 * i + 1] = hexDigits[s[i] & 0xf];
+    }
+}
+
+void hexDecode(const char *in, size_t size, char *out)
+{
+    const uint8_t *s = reinterpret_cast<const uint8_t*>(in);
+    size_t i = kernels.hexDecode(s, size, reinterpret_cast<uint8_t*>(out), size);
+    for(; i < size; i++)
+        out[i] = decodeTables.hex[s[2 * i]] << 4 | decodeTables.hex[s[2 * i + 1]];
+}
+
+}
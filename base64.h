@@ -0,0 +1,44 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstddef>
+
+namespace LibXISF
+{
+
+/** Size of base64 text for size bytes including padding */
+inline size_t base64EncodedSize(size_t size) { return (size + 2) / 3 * 4; }
+/** Upper bound of decoded size of base64 text with size characters */
+inline size_t base64DecodedSize(size_t size) { return size / 4 * 3 + 2; }
+
+/** Encode size bytes into base64EncodedSize(size) characters */
+void base64Encode(const char *in, size_t size, char *out);
+/** Decode base64 text. Characters outside of alphabet like whitespace and padding are skipped.
+ *  At most outSize bytes are written. Return number of decoded bytes */
+size_t base64Decode(const char *in, size_t size, char *out, size_t outSize);
+/** Encode size bytes into size * 2 lowercase hex digits */
+void hexEncode(const char *in, size_t size, char *out);
+/** Decode size * 2 hex digits into size bytes. Invalid digits decode as zero */
+void hexDecode(const char *in, size_t size, char *out);
+
+}
+
+#endif // BASE64_H
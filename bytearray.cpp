@@ -17,164 +17,236 @@
  ************************************************************************/
 
 #include "libxisf.h"
+#include "base64.h"
+#include <algorithm>
 
 namespace LibXISF
 {
 
+struct ByteArray::Buffer
+{
+    char *ptr = nullptr;
+    size_t capacity = 0;
+    std::shared_ptr<Allocator> allocator;
+    std::function<void(char*)> release;
+    ~Buffer()
+    {
+        if(release)
+            release(ptr);
+        else if(ptr)
+            allocator->deallocate(ptr, capacity);
+    }
+};
+
 void ByteArray::makeUnique()
 {
-    if(!_data.unique())
-        _data = std::make_unique<PtrType>(_data->begin(), _data->end());
+    if(_data && _data.use_count() > 1)
+        reallocate(_size);
+}
+
+void ByteArray::reallocate(size_t capacity)
+{
+    // adopted memory is never resized in place, it is copied instead
+    if(_data && _data.use_count() == 1 && _offset == 0 && !_data->release)
+    {
+        if(!_data->ptr)
+            _data->ptr = capacity ? static_cast<char*>(_data->allocator->allocate(capacity)) : nullptr;
+        else if(capacity)
+            _data->ptr = static_cast<char*>(_data->allocator->reallocate(_data->ptr, _data->capacity, capacity, std::min(_size, capacity)));
+        else
+        {
+            _data->allocator->deallocate(_data->ptr, _data->capacity);
+            _data->ptr = nullptr;
+        }
+        _data->capacity = capacity;
+        return;
+    }
+
+    auto buffer = std::make_shared<Buffer>();
+    buffer->allocator = allocator();
+    buffer->ptr = capacity ? static_cast<char*>(buffer->allocator->allocate(capacity)) : nullptr;
+    buffer->capacity = capacity;
+    if(_data && _size && capacity)
+        std::memcpy(buffer->ptr, _data->ptr + _offset, std::min(_size, capacity));
+    _data = std::move(buffer);
+    _offset = 0;
 }
 
 ByteArray::ByteArray(size_t size)
 {
-    _data = std::make_shared<std::vector<char>>();
-    _data->resize(size);
+    resize(size);
 }
 
-ByteArray::ByteArray(const char *ptr) : ByteArray((size_t)0)
+ByteArray::ByteArray(const std::shared_ptr<Allocator> &allocator) :
+    _data(std::make_shared<Buffer>())
 {
-    size_t len = std::strlen(ptr);
-    if(len)
-    {
-        _data->resize(len);
-        std::memcpy(data(), ptr, len);
-    }
+    _data->allocator = allocator ? allocator : Allocator::defaultAllocator();
+}
+
+ByteArray::ByteArray(char *ptr, size_t size, std::function<void(char*)> release) :
+    _data(std::make_shared<Buffer>()),
+    _size(size)
+{
+    _data->ptr = ptr;
+    _data->capacity = size;
+    _data->allocator = Allocator::defaultAllocator();
+    // empty callback means memory stays owned by caller
+    if(release)
+        _data->release = std::move(release);
+    else
+        _data->release = [](char*){};
 }
 
-ByteArray::ByteArray(const ByteArray &d)
+ByteArray::ByteArray(const char *ptr) : ByteArray(ptr, std::strlen(ptr))
 {
-    _data = d._data;
+}
+
+ByteArray::ByteArray(const char *ptr, size_t size)
+{
+    resizeUninitialized(size);
+    if(size)
+        std::memcpy(data(), ptr, size);
+}
+
+ByteArray::ByteArray(ByteArray &&d) noexcept :
+    _data(std::move(d._data)),
+    _offset(d._offset),
+    _size(d._size)
+{
+    d._offset = 0;
+    d._size = 0;
+}
+
+ByteArray &ByteArray::operator=(ByteArray &&d) noexcept
+{
+    _data = std::move(d._data);
+    _offset = d._offset;
+    _size = d._size;
+    d._offset = 0;
+    d._size = 0;
+    return *this;
 }
 
 char& ByteArray::operator[](size_t i)
 {
     makeUnique();
-    return (*_data)[i];
+    return _data->ptr[_offset + i];
 }
 
 const char& ByteArray::operator[](size_t i) const
 {
-    return (*_data)[i];
+    return _data->ptr[_offset + i];
 }
 
-size_t ByteArray::size() const
+char *ByteArray::data()
 {
-    return _data->size();
+    makeUnique();
+    return _data ? _data->ptr + _offset : nullptr;
 }
 
-void ByteArray::resize(size_t newsize)
+const char *ByteArray::data() const
 {
-    makeUnique();
-    _data->resize(newsize);
+    return _data ? _data->ptr + _offset : nullptr;
 }
 
-void ByteArray::append(char c)
+const char *ByteArray::constData() const
 {
-    _data->push_back(c);
+    return _data ? _data->ptr + _offset : nullptr;
 }
 
-void ByteArray::decodeBase64()
+size_t ByteArray::size() const
 {
-    int i = 0;
-    Ptr tmp = std::make_unique<PtrType>();
+    return _size;
+}
 
-    uint8_t c4[4] = {0};
-    for(uint8_t c : *_data)
+void ByteArray::resize(size_t newsize)
+{
+    size_t oldsize = _size;
+    resizeUninitialized(newsize);
+    if(newsize > oldsize)
+        std::memset(_data->ptr + _offset + oldsize, 0, newsize - oldsize);
+}
+
+void ByteArray::resizeUninitialized(size_t newsize)
+{
+    if(newsize <= _size)
     {
-        if(c >= 'A' && c <= 'Z')c4[i++] = c - 'A';
-        else if(c >= 'a' && c <= 'z')c4[i++] = c - 'a' + 26;
-        else if(c >= '0' && c <= '9')c4[i++] = c - '0' + 52;
-        else if(c == '+')c4[i++] = 62;
-        else if(c == '/')c4[i++] = 63;
+        // shrinking doesn't modify data so storage may stay shared
+        _size = newsize;
+        return;
+    }
 
-        if(i == 4)
-        {
-            tmp->push_back((c4[0] << 2) | (c4[1] >> 4));
-            tmp->push_back((c4[1] << 4) | (c4[2] >> 2));
-            tmp->push_back((c4[2] << 6) | c4[3]);
-            i = 0;
-        }
+    if(!_data || _data.use_count() > 1 || _offset + newsize > _data->capacity)
+    {
+        size_t capacity = newsize;
+        // leave space for further growth when array is growing repeatedly
+        if(_data && _size)
+            capacity = std::max(newsize, _size + _size / 2);
+        reallocate(capacity);
     }
+    _size = newsize;
+}
 
-    if(i > 1)tmp->push_back((c4[0] << 2) | (c4[1] >> 4));
-    if(i > 2)tmp->push_back((c4[1] << 4) | (c4[2] >> 2));
+void ByteArray::reserve(size_t size)
+{
+    if(!_data || _data.use_count() > 1 || _offset + size > _data->capacity)
+        reallocate(std::max(size, _size));
+}
 
-    std::swap(_data, tmp);
+ByteArray ByteArray::slice(size_t offset, size_t size) const
+{
+    if(offset > _size || size > _size - offset)
+        throw Error("Out of bounds");
+
+    ByteArray ret;
+    ret._data = _data;
+    ret._offset = _offset + offset;
+    ret._size = size;
+    return ret;
 }
 
-void ByteArray::encodeBase64()
+std::shared_ptr<Allocator> ByteArray::allocator() const
 {
-    static const char *base64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    Ptr tmp = std::make_unique<PtrType>();
-    int i = 0;
-    uint8_t sextet[4] = {0};
-    for(uint8_t c : *_data)
-    {
-        switch(i)
-        {
-        case 0:
-            sextet[0] |= c >> 2 & 0x3f;
-            sextet[1] |= c << 4 & 0x3f;
-            i++;
-            break;
-        case 1:
-            sextet[1] |= c >> 4 & 0x3f;
-            sextet[2] |= c << 2 & 0x3f;
-            i++;
-            break;
-        case 2:
-            sextet[2] |= c >> 6 & 0x3f;
-            sextet[3] = c & 0x3f;
-            i = 0;
-            for(int o=0; o<4; o++)
-                tmp->push_back(base64[sextet[o]]);
-            std::memset(sextet, 0, sizeof(sextet));
-            break;
-        }
-    }
-    for(int o = 0; o <= i && i; o++)
-        tmp->push_back(base64[sextet[o]]);
+    return _data ? _data->allocator : Allocator::defaultAllocator();
+}
+
+void ByteArray::append(char c)
+{
+    resizeUninitialized(_size + 1);
+    _data->ptr[_offset + _size - 1] = c;
+}
 
-    if(tmp->size() % 4)
-        tmp->resize(tmp->size() + 4 - (tmp->size() % 4), '=');
-    std::swap(_data, tmp);
+void ByteArray::decodeBase64()
+{
+    ByteArray tmp(allocator());
+    tmp.resizeUninitialized(base64DecodedSize(_size));
+    tmp.resizeUninitialized(base64Decode(constData(), _size, tmp.data(), tmp.size()));
+    *this = std::move(tmp);
 }
 
+void ByteArray::encodeBase64()
+{
+    ByteArray tmp(allocator());
+    tmp.reserve(base64EncodedSize(_size) + 1);
+    tmp.resizeUninitialized(base64EncodedSize(_size));
+    base64Encode(constData(), _size, tmp.data());
+    *this = std::move(tmp);
+}
 
 void ByteArray::encodeHex()
 {
-    static const char *hex = "0123456789abcdef";
-    Ptr tmp = std::make_unique<PtrType>(_data->size() * 2);
-    for(size_t i = 0; i< _data->size(); i++)
-    {
-        uint8_t t = static_cast<uint8_t>(_data->at(i));
-        (*tmp)[2*i + 0] = hex[(t & 0xf0) >> 4];
-        (*tmp)[2*i + 1] = hex[t & 0xf];
-    }
-    std::swap(_data, tmp);
+    ByteArray tmp(allocator());
+    tmp.resizeUninitialized(_size * 2);
+    hexEncode(constData(), _size, tmp.data());
+    *this = std::move(tmp);
 }
 
 void ByteArray::decodeHex()
 {
-    auto toByte = [](char c) -> char
-    {
-        if(c >= '0' && c <= '9')
-            return c - '0';
-        if(c >= 'A' && c <= 'F')
-            return c - '7';
-        if(c >= 'a' && c <= 'f')
-            return c - 'W';
-        return 0;
-    };
-
-    Ptr tmp = std::make_unique<PtrType>(size() / 2);
-    for(size_t i = 0; i< tmp->size(); i++)
-    {
-        (*tmp)[i] = (toByte(_data->at(i*2)) << 4) | toByte(_data->at(i*2+1));
-    }
-    std::swap(_data, tmp);
+    ByteArray tmp(allocator());
+    tmp.resizeUninitialized(_size / 2);
+    hexDecode(constData(), tmp.size(), tmp.data());
+    *this = std::move(tmp);
 }
 
 }
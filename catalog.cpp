@@ -0,0 +1,524 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "libxisf.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace LibXISF
+{
+
+void runParallel(int threads, size_t count, const std::function<void(size_t)> &func);
+std::string normalizeKeywordValue(std::string_view value);
+
+static const char catalogMagic[8] = {'X', 'I', 'S', 'F', 'C', 'A', 'T', 'L'};
+static const uint32_t catalogVersion = 1;
+
+/** Single value of image. Keys are interned so index stores every name only once */
+struct CatalogField
+{
+    enum Kind : uint8_t
+    {
+        Builtin,
+        Keyword,
+        Property
+    };
+    uint32_t key;
+    Kind kind;
+    bool numeric;
+    double number;
+    String text;
+};
+
+struct CatalogImage
+{
+    // sorted by key for binary search
+    std::vector<CatalogField> fields;
+};
+
+struct CatalogFile
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    std::vector<CatalogImage> images;
+};
+
+/** Serialization helpers, index is stored in host byte order */
+class CatalogWriter
+{
+public:
+    std::string data;
+    template<typename T>
+    void put(T value)
+    {
+        data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void putString(const String &str)
+    {
+        put<uint32_t>(str.size());
+        data.append(str);
+    }
+};
+
+class CatalogReader
+{
+    const char *_pos;
+    const char *_end;
+public:
+    CatalogReader(const char *data, size_t size) : _pos(data), _end(data + size) {}
+    template<typename T>
+    T get()
+    {
+        T value;
+        if(sizeof(value) > (size_t)(_end - _pos))
+            throw Error("Catalog index is truncated");
+        std::memcpy(&value, _pos, sizeof(value));
+        _pos += sizeof(value);
+        return value;
+    }
+    String getString()
+    {
+        uint32_t size = get<uint32_t>();
+        if(size > (size_t)(_end - _pos))
+            throw Error("Catalog index is truncated");
+        String str(_pos, size);
+        _pos += size;
+        return str;
+    }
+};
+
+class CatalogPrivate
+{
+public:
+    void load();
+    uint32_t keyId(const String &key);
+    void addField(CatalogImage &image, const String &key, CatalogField::Kind kind, const String &text);
+    CatalogEntry entry(const String &path, uint32_t index, const CatalogImage &image) const;
+    static std::vector<CatalogEntry> readFile(const String &path);
+    static bool parseNumber(const String &text, double &number);
+    static bool match(const CatalogField &field, const CatalogFilter &filter, bool numeric, double number);
+
+    String indexPath;
+    std::vector<String> keys;
+    std::unordered_map<String, uint32_t> keyIds;
+    std::map<String, CatalogFile> files;
+};
+
+uint32_t CatalogPrivate::keyId(const String &key)
+{
+    auto it = keyIds.find(key);
+    if(it != keyIds.end())
+        return it->second;
+
+    uint32_t id = keys.size();
+    keys.push_back(key);
+    keyIds[key] = id;
+    return id;
+}
+
+bool CatalogPrivate::parseNumber(const String &text, double &number)
+{
+    if(text.empty())
+        return false;
+
+    char *end = nullptr;
+    number = std::strtod(text.c_str(), &end);
+    return end == text.c_str() + text.size() && std::isfinite(number);
+}
+
+void CatalogPrivate::addField(CatalogImage &image, const String &key, CatalogField::Kind kind, const String &text)
+{
+    CatalogField field;
+    field.key = keyId(key);
+    field.kind = kind;
+    field.text = text;
+    field.numeric = parseNumber(text, field.number);
+    if(!field.numeric)
+        field.number = 0;
+    image.fields.push_back(std::move(field));
+}
+
+std::vector<CatalogEntry> CatalogPrivate::readFile(const String &path)
+{
+    std::vector<CatalogEntry> entries;
+    try
+    {
+        XISFReader reader;
+        reader.open(path);
+        for(int i = 0; i < reader.imagesCount(); i++)
+        {
+            const Image &image = reader.getImage(i, false);
+            CatalogEntry entry;
+            entry.path = path;
+            entry.imageIndex = i;
+            entry.info.width = image.width();
+            entry.info.height = image.height();
+            entry.info.channelCount = image.channelCount();
+            entry.info.sampleFormat = image.sampleFormat();
+            entry.info.imageType = image.imageType();
+            entry.info.colorSpace = image.colorSpace();
+            for(auto &keyword : image.fitsKeywords())
+                entry.info.fitsKeywords.push_back({keyword.name, normalizeKeywordValue(keyword.value), String()});
+            for(auto &property : image.imageProperties())
+            {
+                Variant::Type type = property.value.type();
+                if(type == Variant::Type::Monostate || type >= Variant::Type::I8Vector)
+                    continue;
+                entry.properties.push_back({property.id, property.value.toString()});
+            }
+            entries.push_back(std::move(entry));
+        }
+    }
+    catch(Error &)
+    {
+        // malformed file is kept in index without images so it isn't read again until it changes,
+        // other failures like bad_alloc propagate so file isn't cached as empty
+        entries.clear();
+    }
+    return entries;
+}
+
+CatalogEntry CatalogPrivate::entry(const String &path, uint32_t index, const CatalogImage &image) const
+{
+    CatalogEntry entry;
+    entry.path = path;
+    entry.imageIndex = index;
+    for(auto &field : image.fields)
+    {
+        const String &key = keys[field.key];
+        if(field.kind == CatalogField::Keyword)
+            entry.info.fitsKeywords.push_back({key, field.text, String()});
+        else if(field.kind == CatalogField::Property)
+            entry.properties.push_back({key, field.text});
+        else if(key == "width")
+            entry.info.width = field.number;
+        else if(key == "height")
+            entry.info.height = field.number;
+        else if(key == "channelCount")
+            entry.info.channelCount = field.number;
+        else if(key == "imageType")
+            entry.info.imageType = Image::imageTypeEnum(field.text);
+        else if(key == "sampleFormat")
+            entry.info.sampleFormat = Image::sampleFormatEnum(field.text);
+        else if(key == "colorSpace")
+            entry.info.colorSpace = Image::colorSpaceEnum(field.text);
+    }
+    return entry;
+}
+
+bool CatalogPrivate::match(const CatalogField &field, const CatalogFilter &filter, bool numeric, double number)
+{
+    int cmp;
+    if(numeric && field.numeric)
+    {
+        if(std::abs(field.number - number) <= filter.tolerance)
+            cmp = 0;
+        else
+            cmp = field.number < number ? -1 : 1;
+    }
+    else
+    {
+        cmp = field.text.compare(filter.value);
+    }
+
+    switch(filter.op)
+    {
+    case CatalogFilter::Equal: return cmp == 0;
+    case CatalogFilter::NotEqual: return cmp != 0;
+    case CatalogFilter::Less: return cmp < 0;
+    case CatalogFilter::LessEqual: return cmp <= 0;
+    case CatalogFilter::Greater: return cmp > 0;
+    case CatalogFilter::GreaterEqual: return cmp >= 0;
+    }
+    return false;
+}
+
+void CatalogPrivate::load()
+{
+    std::ifstream file(indexPath.c_str(), std::ios_base::in | std::ios_base::binary);
+    if(!file)
+        return;
+
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    try
+    {
+        CatalogReader reader(data.data(), data.size());
+        char magic[sizeof(catalogMagic)];
+        for(auto &c : magic)
+            c = reader.get<char>();
+        if(std::memcmp(magic, catalogMagic, sizeof(magic)) != 0 || reader.get<uint32_t>() != catalogVersion)
+            return;
+
+        uint32_t keyCount = reader.get<uint32_t>();
+        for(uint32_t i = 0; i < keyCount; i++)
+            keyId(reader.getString());
+
+        uint32_t fileCount = reader.get<uint32_t>();
+        for(uint32_t i = 0; i < fileCount; i++)
+        {
+            String path = reader.getString();
+            CatalogFile &record = files[path];
+            record.size = reader.get<uint64_t>();
+            record.mtime = reader.get<int64_t>();
+            record.images.resize(reader.get<uint32_t>());
+            for(auto &image : record.images)
+            {
+                image.fields.resize(reader.get<uint32_t>());
+                for(auto &field : image.fields)
+                {
+                    field.key = reader.get<uint32_t>();
+                    if(field.key >= keys.size())
+                        throw Error("Invalid catalog index");
+                    uint8_t flags = reader.get<uint8_t>();
+                    field.kind = static_cast<CatalogField::Kind>(flags & 0x7f);
+                    field.numeric = flags & 0x80;
+                    field.number = field.numeric ? reader.get<double>() : 0.0;
+                    field.text = reader.getString();
+                }
+            }
+        }
+    }
+    catch(Error &)
+    {
+        keys.clear();
+        keyIds.clear();
+        files.clear();
+    }
+}
+
+Catalog::Catalog(const String &indexPath)
+{
+    p = new CatalogPrivate;
+    p->indexPath = indexPath;
+    p->load();
+}
+
+Catalog::~Catalog()
+{
+    delete p;
+}
+
+size_t Catalog::update(const String &directory, int threads)
+{
+    namespace fs = std::filesystem;
+    struct Candidate
+    {
+        String path;
+        uint64_t size;
+        int64_t mtime;
+    };
+    std::vector<Candidate> changed;
+    std::unordered_set<String> seen;
+
+    std::error_code ec;
+    for(fs::recursive_directory_iterator it(directory, fs::directory_options::skip_permission_denied, ec), end; it != end; it.increment(ec))
+    {
+        if(!it->is_regular_file(ec))
+            continue;
+
+        String extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if(extension != ".xisf")
+            continue;
+
+        Candidate candidate;
+        candidate.path = it->path().string();
+        seen.insert(candidate.path);
+        // keep previous record of file that can't be stat-ed right now
+        candidate.size = it->file_size(ec);
+        if(ec)
+            continue;
+        candidate.mtime = it->last_write_time(ec).time_since_epoch().count();
+        if(ec)
+            continue;
+
+        auto record = p->files.find(candidate.path);
+        if(record == p->files.end() || record->second.size != candidate.size || record->second.mtime != candidate.mtime)
+            changed.push_back(std::move(candidate));
+    }
+
+    // failed scan would look like deleted files
+    if(ec)
+        throw Error("Failed to scan directory " + directory + ": " + ec.message());
+
+    // entries of files that were deleted from scanned directory
+    String prefix = (fs::path(directory) / "").string();
+    for(auto it = p->files.lower_bound(prefix); it != p->files.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+    {
+        if(seen.count(it->first))
+            it++;
+        else
+            it = p->files.erase(it);
+    }
+
+    if(threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<std::vector<CatalogEntry>> results(changed.size());
+    runParallel(threads, changed.size(), [&](size_t i)
+    {
+        results[i] = CatalogPrivate::readFile(changed[i].path);
+    });
+
+    // interning of keys isn't thread safe so records are built afterwards
+    for(size_t i = 0; i < changed.size(); i++)
+    {
+        CatalogFile &record = p->files[changed[i].path];
+        record.size = changed[i].size;
+        record.mtime = changed[i].mtime;
+        record.images.clear();
+        for(auto &entry : results[i])
+        {
+            CatalogImage image;
+            p->addField(image, "imageType", CatalogField::Builtin, Image::imageTypeString(entry.info.imageType));
+            p->addField(image, "width", CatalogField::Builtin, std::to_string(entry.info.width));
+            p->addField(image, "height", CatalogField::Builtin, std::to_string(entry.info.height));
+            p->addField(image, "channelCount", CatalogField::Builtin, std::to_string(entry.info.channelCount));
+            p->addField(image, "sampleFormat", CatalogField::Builtin, Image::sampleFormatString(entry.info.sampleFormat));
+            p->addField(image, "colorSpace", CatalogField::Builtin, Image::colorSpaceString(entry.info.colorSpace));
+            for(auto &keyword : entry.info.fitsKeywords)
+                p->addField(image, keyword.name, CatalogField::Keyword, keyword.value);
+            for(auto &property : entry.properties)
+                p->addField(image, property.first, CatalogField::Property, property.second);
+
+            std::stable_sort(image.fields.begin(), image.fields.end(), [](const CatalogField &a, const CatalogField &b){ return a.key < b.key; });
+            record.images.push_back(std::move(image));
+        }
+    }
+
+    return changed.size();
+}
+
+void Catalog::save() const
+{
+    CatalogWriter writer;
+    writer.data.append(catalogMagic, sizeof(catalogMagic));
+    writer.put<uint32_t>(catalogVersion);
+    writer.put<uint32_t>(p->keys.size());
+    for(auto &key : p->keys)
+        writer.putString(key);
+
+    writer.put<uint32_t>(p->files.size());
+    for(auto &file : p->files)
+    {
+        writer.putString(file.first);
+        writer.put<uint64_t>(file.second.size);
+        writer.put<int64_t>(file.second.mtime);
+        writer.put<uint32_t>(file.second.images.size());
+        for(auto &image : file.second.images)
+        {
+            writer.put<uint32_t>(image.fields.size());
+            for(auto &field : image.fields)
+            {
+                writer.put<uint32_t>(field.key);
+                writer.put<uint8_t>(field.kind | (field.numeric ? 0x80 : 0));
+                if(field.numeric)
+                    writer.put<double>(field.number);
+                writer.putString(field.text);
+            }
+        }
+    }
+
+    // write to temporary file first so interrupted save doesn't destroy old index
+    String tmpPath = p->indexPath + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        file.write(writer.data.data(), writer.data.size());
+        file.close();
+        if(file.fail())
+            throw Error("Failed to write catalog index");
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, p->indexPath, ec);
+    if(ec)
+        throw Error("Failed to write catalog index");
+}
+
+size_t Catalog::fileCount() const
+{
+    return p->files.size();
+}
+
+size_t Catalog::imageCount() const
+{
+    size_t count = 0;
+    for(auto &file : p->files)
+        count += file.second.images.size();
+    return count;
+}
+
+std::vector<CatalogEntry> Catalog::query(const std::vector<CatalogFilter> &filters) const
+{
+    struct ResolvedFilter
+    {
+        const CatalogFilter *filter;
+        uint32_t key;
+        bool numeric;
+        double number;
+    };
+
+    std::vector<ResolvedFilter> resolved;
+    for(auto &filter : filters)
+    {
+        auto key = p->keyIds.find(filter.key);
+        // key that is not in any file can't match
+        if(key == p->keyIds.end())
+            return {};
+        ResolvedFilter r = {&filter, key->second, false, 0.0};
+        r.numeric = CatalogPrivate::parseNumber(filter.value, r.number);
+        resolved.push_back(r);
+    }
+
+    auto byKey = [](const CatalogField &field, uint32_t key){ return field.key < key; };
+    std::vector<CatalogEntry> result;
+    for(auto &file : p->files)
+    {
+        for(size_t i = 0; i < file.second.images.size(); i++)
+        {
+            const std::vector<CatalogField> &fields = file.second.images[i].fields;
+            bool matches = true;
+            for(auto &r : resolved)
+            {
+                // image match when any of fields with same key match, for example repeated keyword
+                bool any = false;
+                for(auto it = std::lower_bound(fields.begin(), fields.end(), r.key, byKey); it != fields.end() && it->key == r.key && !any; it++)
+                    any = CatalogPrivate::match(*it, *r.filter, r.numeric, r.number);
+
+                if(!any)
+                {
+                    matches = false;
+                    break;
+                }
+            }
+
+            if(matches)
+                result.push_back(p->entry(file.first, i, file.second.images[i]));
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,184 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "fileio.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <climits>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace LibXISF
+{
+
+// Linux transfer at most this many bytes in single read/write call
+static const size_t MaxTransfer = 0x7ffff000;
+
+int openForRead(const String &name)
+{
+#ifdef _WIN32
+    int fd = _open(name.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if(fd < 0)
+        throw Error("Failed to open file");
+    return fd;
+}
+
+size_t readFull(int fd, char *data, size_t size)
+{
+    size_t total = 0;
+    while(total < size)
+    {
+#ifdef _WIN32
+        int ret = _read(fd, data + total, (unsigned int)std::min(size - total, MaxTransfer));
+#else
+        ssize_t ret = ::read(fd, data + total, std::min(size - total, MaxTransfer));
+        if(ret < 0 && errno == EINTR)
+            continue;
+#endif
+        if(ret < 0)
+            throw Error("Failed to read from file");
+        if(ret == 0)
+            break;
+        total += ret;
+    }
+    return total;
+}
+
+int openForWrite(const String &name)
+{
+#ifdef _WIN32
+    int fd = _open(name.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+#endif
+    if(fd < 0)
+        throw Error("Failed to open file");
+    return fd;
+}
+
+bool closeFile(int fd)
+{
+#ifdef _WIN32
+    return _close(fd) == 0;
+#else
+    return ::close(fd) == 0;
+#endif
+}
+
+#ifdef _WIN32
+void writeVectored(int fd, const std::vector<IOBuffer> &buffers)
+{
+    for(auto &buffer : buffers)
+    {
+        const char *ptr = buffer.data;
+        size_t size = buffer.size;
+        while(size > 0)
+        {
+            int ret = _write(fd, ptr, (unsigned int)std::min(size, MaxTransfer));
+            if(ret <= 0)
+                throw Error("Failed to write to file");
+            ptr += ret;
+            size -= ret;
+        }
+    }
+}
+#else
+void writeVectored(int fd, const std::vector<IOBuffer> &buffers)
+{
+#ifdef IOV_MAX
+    const size_t maxIov = IOV_MAX;
+#else
+    const size_t maxIov = 1024;
+#endif
+    std::vector<iovec> iov;
+    iov.reserve(buffers.size());
+    for(auto &buffer : buffers)
+    {
+        // split huge buffers so single iovec never exceed transfer limit
+        for(size_t offset = 0; offset < buffer.size; offset += MaxTransfer)
+            iov.push_back({const_cast<char*>(buffer.data + offset), std::min(buffer.size - offset, MaxTransfer)});
+    }
+
+    size_t i = 0;
+    while(i < iov.size())
+    {
+        size_t count = std::min(iov.size() - i, maxIov);
+        ssize_t ret = ::writev(fd, &iov[i], count);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            throw Error("Failed to write to file");
+
+        // skip fully written buffers and adjust partially written one
+        size_t written = ret;
+        while(i < iov.size() && written >= iov[i].iov_len)
+            written -= iov[i++].iov_len;
+
+        if(written)
+        {
+            iov[i].iov_base = static_cast<char*>(iov[i].iov_base) + written;
+            iov[i].iov_len -= written;
+        }
+    }
+}
+#endif
+
+
+#ifndef _WIN32
+void writeAt(int fd, const char *data, size_t size, uint64_t offset)
+{
+    while(size > 0)
+    {
+        ssize_t ret = ::pwrite(fd, data, std::min(size, MaxTransfer), offset);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            throw Error("Failed to write to file");
+        data += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+void preallocate(int fd, uint64_t size)
+{
+#ifdef __linux__
+    ::posix_fallocate(fd, 0, size);
+#else
+    (void)fd;
+    (void)size;
+#endif
+}
+
+void truncateFile(int fd, uint64_t size)
+{
+    if(::ftruncate(fd, size) != 0)
+        throw Error("Failed to write to file");
+}
+#endif
+
+}
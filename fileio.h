@@ -0,0 +1,54 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <vector>
+#include "libxisf.h"
+
+namespace LibXISF
+{
+
+struct IOBuffer
+{
+    const char *data;
+    size_t size;
+};
+
+/** Open file for reading. Return file descriptor */
+int openForRead(const String &name);
+/** Read up to size bytes, less only at end of file. Return number of bytes read */
+size_t readFull(int fd, char *data, size_t size);
+/** Open file for writing, truncate it if exists. Return file descriptor */
+int openForWrite(const String &name);
+/** Return false when closing failed, for example when delayed write failed */
+bool closeFile(int fd);
+/** Write all buffers in one pass with writev() without copying them into intermediate buffer */
+void writeVectored(int fd, const std::vector<IOBuffer> &buffers);
+#ifndef _WIN32
+/** Write buffer at given file offset with pwrite(). It is safe to call from multiple threads */
+void writeAt(int fd, const char *data, size_t size, uint64_t offset);
+/** Reserve disk space for file. It is only hint so failures are ignored */
+void preallocate(int fd, uint64_t size);
+void truncateFile(int fd, uint64_t size);
+#endif
+
+}
+
+#endif // FILEIO_H
@@ -17,6 +17,8 @@
  ************************************************************************/
 
 #include "libxisf.h"
+#include <algorithm>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <cstring>
@@ -24,6 +26,12 @@
 #include <sstream>
 #include <cstdlib>
 #include <cmath>
+#include <charconv>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <filesystem>
 #include <lz4.h>
 #include <lz4hc.h>
 #include <pugixml.hpp>
@@ -31,14 +39,29 @@
 #ifdef HAVE_ZSTD
 #include <zstd.h>
 #endif
+#include "base64.h"
+#include "fileio.h"
 #include "streambuffer.h"
+#include "xmlreader.h"
+#include "xmlwriter.h"
 
 namespace LibXISF
 {
 
 std::vector<std::string> splitString(const std::string &str, char delimiter);
-void deserializeVariant(const pugi::xml_node &node, Variant &variant, const ByteArray &data);
-void serializeVariant(pugi::xml_node &node, const Variant &variant);
+void runParallel(int threads, size_t count, const std::function<void(size_t)> &func);
+std::string normalizeKeywordValue(std::string_view value);
+uint64_t parseUInt64(const std::string &str, size_t *pos = nullptr);
+double parseDouble(const std::string &str);
+Variant::Type variantType(std::string_view name);
+std::pair<size_t, size_t> variantDimensions(const XmlReader &xml, Variant::Type typeId);
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::string_view value);
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::pair<size_t, size_t> dim, const ByteArray &data);
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::pair<size_t, size_t> dim, const std::function<ByteArray()> &data);
+void serializeVariant(XmlWriter &xml, const Variant &variant, const String &comment);
+bool serializeVariant(const Variant &variant, std::pair<size_t, size_t> &dim, ByteArray &data);
+void serializeVariantDimensions(XmlWriter &xml, Variant::Type type, std::pair<size_t, size_t> dim);
+char* formatScalar(const Variant &variant, char *ptr, char *end);
 Variant variantFromString(Variant::Type type, const String &str);
 
 static std::unordered_map<String, Image::Type> imageTypeToEnum;
@@ -51,6 +74,7 @@ static DataBlock::CompressionCodec compressionCodecOverride = DataBlock::None;
 static bool byteShuffleOverride = false;
 static int compressionLevelOverride = -1;
 const size_t GiB = 1073741824;
+const int FixedWidthDigits = 20;
 
 static const std::unordered_map<String, std::pair<String, Variant::Type>> fitsNameToPropertyIdTypeConvert = {
     {"OBSERVER", {"Observer:Name", Variant::Type::String}},
@@ -82,12 +106,36 @@ static const std::unordered_map<String, std::pair<String, Variant::Type>> fitsNa
     {"TELESCOP", {"Instrument:Telescope:Name", Variant::Type::String}},
 };
 
+
+static void applyCompressionOverride(DataBlock &dataBlock, int sampleFormatSize)
+{
+    if (compressionCodecOverride != DataBlock::None)
+    {
+        dataBlock.codec = compressionCodecOverride;
+        dataBlock.byteShuffling = sampleFormatSize;
+        dataBlock.compressLevel = compressionLevelOverride;
+    }
+}
+
+/** Return size of uncompressed input that codec can process in one call */
+static uint64_t maxSubblockSize(DataBlock::CompressionCodec codec)
+{
+    switch(codec)
+    {
+    case DataBlock::Zlib: return UINT32_MAX;
+    case DataBlock::LZ4:
+    case DataBlock::LZ4HC: return LZ4_MAX_INPUT_SIZE;
+    default: return 0;
+    }
+}
+
 static void byteShuffle(ByteArray &data, int itemSize)
 {
     if(itemSize > 1)
     {
         ByteArray &input = data;
-        ByteArray output(input.size());
+        ByteArray output(input.allocator());
+        output.resizeUninitialized(input.size());
         size_t num = input.size() / itemSize;
         char *s = output.data();
         for(int i=0; i<itemSize; i++)
@@ -97,7 +145,7 @@ static void byteShuffle(ByteArray &data, int itemSize)
                 *s = *u;
         }
         memcpy(s, input.constData() + num * itemSize, input.size() % itemSize);
-        data = output;
+        data = std::move(output);
     }
 }
 
@@ -106,7 +154,8 @@ static void byteUnshuffle(ByteArray &data, int itemSize)
     if(itemSize > 1)
     {
         ByteArray &input = data;
-        ByteArray output(input.size());
+        ByteArray output(input.allocator());
+        output.resizeUninitialized(input.size());
         size_t num = input.size() / itemSize;
         const char *s = input.constData();
         for(int i=0; i<itemSize; i++)
@@ -116,8 +165,28 @@ static void byteUnshuffle(ByteArray &data, int itemSize)
                 *u = *s;
         }
         memcpy(output.data() + num * itemSize, s, input.size() % itemSize);
-        data = output;
+        data = std::move(output);
+    }
+}
+
+/** Decode inline or embedded data directly from XML text buffer without copying it first */
+static ByteArray decodeText(std::string_view text, const String &encoding)
+{
+    size_t size = text.size();
+    ByteArray data;
+    if(encoding == "base64")
+    {
+        data.resizeUninitialized(base64DecodedSize(size));
+        data.resize(base64Decode(text.data(), size, data.data(), data.size()));
+    }
+    else if(encoding == "base16")
+    {
+        data.resizeUninitialized(size / 2);
+        hexDecode(text.data(), data.size(), data.data());
     }
+    else
+        data = ByteArray(text.data(), size);
+    return data;
 }
 
 void DataBlock::decompress(const ByteArray &input, const String &encoding)
@@ -132,6 +201,21 @@ void DataBlock::decompress(const ByteArray &input, const String &encoding)
     if(subblocks.size() == 0)
         subblocks.push_back({tmp.size(), uncompressedSize});
 
+    if(codec != None)
+    {
+        uint64_t compressedSum = 0;
+        uint64_t uncompressedSum = 0;
+        for(auto &block : subblocks)
+        {
+            if(block.first > tmp.size() - compressedSum || block.second > uncompressedSize - uncompressedSum)
+                throw Error("Compressed subblocks don't match data size");
+            compressedSum += block.first;
+            uncompressedSum += block.second;
+        }
+        if(uncompressedSum != uncompressedSize)
+            throw Error("Compressed subblocks don't match uncompressed size");
+    }
+
     switch(codec)
     {
     case None:
@@ -139,13 +223,15 @@ void DataBlock::decompress(const ByteArray &input, const String &encoding)
         break;
     case Zlib:
     {
-        data.resize(uncompressedSize);
+        data = ByteArray(tmp.allocator());
+        data.resizeUninitialized(uncompressedSize);
         const char *srcPtr = tmp.constData();
         char *dstPtr = data.data();
         for(auto &block : subblocks)
         {
             uLongf size = block.second;
-            ::uncompress((Bytef*)dstPtr, &size, (const Bytef*)srcPtr, block.first);
+            if(::uncompress((Bytef*)dstPtr, &size, (const Bytef*)srcPtr, block.first) != Z_OK || size != block.second)
+                throw Error("Zlib decompression failed");
             srcPtr += block.first;
             dstPtr += block.second;
         }
@@ -154,12 +240,13 @@ void DataBlock::decompress(const ByteArray &input, const String &encoding)
     case LZ4:
     case LZ4HC:
     {
-        data.resize(uncompressedSize);
+        data = ByteArray(tmp.allocator());
+        data.resizeUninitialized(uncompressedSize);
         const char *srcPtr = tmp.constData();
         char *dstPtr = data.data();
         for(auto &block : subblocks)
         {
-            if(LZ4_decompress_safe(srcPtr, dstPtr, block.first, block.second) < 0)
+            if(LZ4_decompress_safe(srcPtr, dstPtr, block.first, block.second) != (int)block.second)
                 throw Error("LZ4 decompression failed");
             srcPtr += block.first;
             dstPtr += block.second;
@@ -169,12 +256,14 @@ void DataBlock::decompress(const ByteArray &input, const String &encoding)
     case ZSTD:
 #ifdef HAVE_ZSTD
     {
-        data.resize(uncompressedSize);
+        data = ByteArray(tmp.allocator());
+        data.resizeUninitialized(uncompressedSize);
         const char *srcPtr = tmp.constData();
         char *dstPtr = data.data();
         for(auto &block : subblocks)
         {
-            if(ZSTD_isError(ZSTD_decompress(dstPtr, block.second, srcPtr, block.first)))
+            size_t size = ZSTD_decompress(dstPtr, block.second, srcPtr, block.first);
+            if(ZSTD_isError(size) || size != block.second)
                 throw Error("ZSTD decompression failed");
             srcPtr += block.first;
             dstPtr += block.second;
@@ -197,16 +286,14 @@ void DataBlock::compress(int sampleFormatSize)
 {
     ByteArray tmp = data;
     uncompressedSize = data.size();
+    subblocks.clear();
 
-    if (compressionCodecOverride != CompressionCodec::None)
-    {
-        codec = compressionCodecOverride;
-        byteShuffling = sampleFormatSize;
-        compressLevel = compressionLevelOverride;
-    }
+    applyCompressionOverride(*this, sampleFormatSize);
 
     byteShuffle(tmp, byteShuffling);
 
+    // compressed data goes into fresh buffer so storage shared with tmp is not copied when written
+    ByteArray output(tmp.allocator());
     switch(codec)
     {
     case None:
@@ -219,17 +306,18 @@ void DataBlock::compress(int sampleFormatSize)
         int64_t inPtr = 0;
         while(inPtr < size)
         {
-            int64_t inSize = UINT32_MAX < size - inPtr ? UINT32_MAX : size - inPtr;
-            data.resize(compSize + compressBound(inSize));
-            uLongf outSize = data.size() - compSize;
-            if(::compress2((Bytef*)data.data() + compSize, &outSize, (const Bytef*)tmp.constData() + inPtr, inSize, compressLevel) != Z_OK)
+            int64_t inSize = std::min<int64_t>(maxSubblockSize(codec), size - inPtr);
+            output.resizeUninitialized(compSize + compressBound(inSize));
+            uLongf outSize = output.size() - compSize;
+            if(::compress2((Bytef*)output.data() + compSize, &outSize, (const Bytef*)tmp.constData() + inPtr, inSize, compressLevel) != Z_OK)
                 throw Error("Zlib compression failed");
 
             compSize += outSize;
             inPtr += inSize;
             subblocks.push_back({outSize, inSize});
         }
-        data.resize(compSize);
+        output.resize(compSize);
+        data = std::move(output);
         break;
     }
     case LZ4:
@@ -240,14 +328,14 @@ void DataBlock::compress(int sampleFormatSize)
         int64_t inPtr = 0;
         while(inPtr < size)
         {
-            int64_t inSize = LZ4_MAX_INPUT_SIZE < size - inPtr ? LZ4_MAX_INPUT_SIZE : size - inPtr;
-            data.resize(compSize + LZ4_compressBound(inSize));
+            int64_t inSize = std::min<int64_t>(maxSubblockSize(codec), size - inPtr);
+            output.resizeUninitialized(compSize + LZ4_compressBound(inSize));
             int outSize = 0;
 
             if(codec == LZ4)
-                outSize = LZ4_compress_default(tmp.constData() + inPtr, data.data() + compSize, inSize, data.size() - compSize);
+                outSize = LZ4_compress_default(tmp.constData() + inPtr, output.data() + compSize, inSize, output.size() - compSize);
             else
-                outSize = LZ4_compress_HC(tmp.constData() + inPtr, data.data() + compSize, inSize, data.size() - compSize, compressLevel < 0 ? LZ4HC_CLEVEL_DEFAULT : compressLevel);
+                outSize = LZ4_compress_HC(tmp.constData() + inPtr, output.data() + compSize, inSize, output.size() - compSize, compressLevel < 0 ? LZ4HC_CLEVEL_DEFAULT : compressLevel);
 
             if(outSize <= 0)
                 throw Error("LZ4 compression failed");
@@ -256,19 +344,21 @@ void DataBlock::compress(int sampleFormatSize)
             inPtr += inSize;
             subblocks.push_back({outSize, inSize});
         }
-        data.resize(compSize);
+        output.resize(compSize);
+        data = std::move(output);
         break;
     }
     case ZSTD:
     {
 #ifdef HAVE_ZSTD
         size_t compSize = 0;
-        data.resize(ZSTD_compressBound(uncompressedSize));
-        compSize = ZSTD_compress(data.data(), data.size(), tmp.data(), tmp.size(), compressLevel < 0 ? ZSTD_CLEVEL_DEFAULT : compressLevel);
+        output.resizeUninitialized(ZSTD_compressBound(uncompressedSize));
+        compSize = ZSTD_compress(output.data(), output.size(), tmp.constData(), tmp.size(), compressLevel < 0 ? ZSTD_CLEVEL_DEFAULT : compressLevel);
         if(ZSTD_isError(compSize))
             throw Error("ZSTD compression failed");
 
-        data.resize(compSize);
+        output.resize(compSize);
+        data = std::move(output);
 #else
         throw Error("ZSTD support not compiled");
 #endif
@@ -411,24 +501,79 @@ const std::vector<Property>& Image::imageProperties() const
     return _properties;
 }
 
+static std::string_view indexKey(const Property &property)
+{
+    return property.id;
+}
+
+static std::string_view indexKey(const FITSKeyword &keyword)
+{
+    return keyword.name;
+}
+
+/** Return position of item with key or -1. Slots store position + 1, zero marks empty slot */
+template<typename T>
+static int64_t indexFind(const std::vector<uint32_t> &index, const std::vector<T> &items, std::string_view key)
+{
+    if(index.empty())
+        return -1;
+
+    size_t mask = index.size() - 1;
+    for(size_t i = std::hash<std::string_view>()(key) & mask; index[i]; i = (i + 1) & mask)
+    {
+        if(indexKey(items[index[i] - 1]) == key)
+            return index[i] - 1;
+    }
+    return -1;
+}
+
+/** Index item at pos unless item with same key is already indexed */
+template<typename T>
+static void indexInsert(std::vector<uint32_t> &index, const std::vector<T> &items, size_t pos)
+{
+    if((pos + 1) * 2 > index.size())
+    {
+        index.assign(std::max<size_t>(16, index.size() * 2), 0);
+        for(size_t i = 0; i < pos; i++)
+            indexInsert(index, items, i);
+    }
+
+    size_t mask = index.size() - 1;
+    std::string_view key = indexKey(items[pos]);
+    size_t i = std::hash<std::string_view>()(key) & mask;
+    for(; index[i]; i = (i + 1) & mask)
+    {
+        if(indexKey(items[index[i] - 1]) == key)
+            return;
+    }
+    index[i] = pos + 1;
+}
+
 void Image::addProperty(const Property &property)
 {
-    if(_propertiesId.count(property.id))
+    if(indexFind(_propertiesIndex, _properties, property.id) >= 0)
         throw Error("Duplicate property id");
 
-    _propertiesId[property.id] = _properties.size();
     _properties.push_back(property);
+    indexInsert(_propertiesIndex, _properties, _properties.size() - 1);
 }
 
 void Image::updateProperty(const Property &property)
 {
-    if(!_propertiesId.count(property.id))
+    int64_t pos = indexFind(_propertiesIndex, _properties, property.id);
+    if(pos < 0)
         addProperty(property);
     else
-        _properties[_propertiesId[property.id]] = property;
+        _properties[pos] = property;
+}
+
+const Property *Image::findProperty(std::string_view id) const
+{
+    int64_t pos = indexFind(_propertiesIndex, _properties, id);
+    return pos >= 0 ? &_properties[pos] : nullptr;
 }
 
-const std::vector<FITSKeyword> Image::fitsKeywords() const
+const std::vector<FITSKeyword>& Image::fitsKeywords() const
 {
     return _fitsKeywords;
 }
@@ -436,6 +581,26 @@ const std::vector<FITSKeyword> Image::fitsKeywords() const
 void Image::addFITSKeyword(const FITSKeyword &keyword)
 {
     _fitsKeywords.push_back(keyword);
+    indexInsert(_fitsKeywordsIndex, _fitsKeywords, _fitsKeywords.size() - 1);
+}
+
+const FITSKeyword *Image::findFITSKeyword(std::string_view name) const
+{
+    int64_t pos = indexFind(_fitsKeywordsIndex, _fitsKeywords, name);
+    return pos >= 0 ? &_fitsKeywords[pos] : nullptr;
+}
+
+/** Append property read from file. Files with duplicate ids are tolerated, first one stays indexed */
+void Image::appendProperty(Property &&property)
+{
+    _properties.push_back(std::move(property));
+    indexInsert(_propertiesIndex, _properties, _properties.size() - 1);
+}
+
+void Image::appendFITSKeyword(FITSKeyword &&keyword)
+{
+    _fitsKeywords.push_back(std::move(keyword));
+    indexInsert(_fitsKeywordsIndex, _fitsKeywords, _fitsKeywords.size() - 1);
 }
 
 bool Image::addFITSKeywordAsProperty(const String &name, const String &value)
@@ -479,16 +644,22 @@ size_t Image::imageDataSize() const
     return _dataBlock.data.size();
 }
 
+void Image::setImageData(const ByteArray &data)
+{
+    if(data.size() != _width * _height * _channelCount * sampleFormatSize(_sampleFormat))
+        throw Error("Image data size doesn't match image geometry");
+
+    _dataBlock.data = data;
+}
+
 DataBlock::CompressionCodec Image::compression() const
 {
     return _dataBlock.codec;
 }
 
-void Image::setCompression(DataBlock::CompressionCodec compression, int level)
+/** Convert compression level in percent into range of codec. Negative level means default of codec */
+static int compressLevelFromPercent(DataBlock::CompressionCodec compression, int level)
 {
-    _dataBlock.codec = compression;
-    _dataBlock.compressLevel = -1;
-
     level = std::min(std::max(level, -1), 100);
 
     auto percentToRange = [](int val, int min, int max)
@@ -502,15 +673,13 @@ void Image::setCompression(DataBlock::CompressionCodec compression, int level)
         switch(compression)
         {
         case DataBlock::CompressionCodec::Zlib:
-            _dataBlock.compressLevel = percentToRange(level, Z_BEST_SPEED, Z_BEST_COMPRESSION);
-            break;
+            return percentToRange(level, Z_BEST_SPEED, Z_BEST_COMPRESSION);
         case DataBlock::CompressionCodec::LZ4:
         case DataBlock::CompressionCodec::LZ4HC:
-            _dataBlock.compressLevel = percentToRange(level, 1, LZ4HC_CLEVEL_MAX);
-            break;
+            return percentToRange(level, 1, LZ4HC_CLEVEL_MAX);
         case DataBlock::CompressionCodec::ZSTD:
 #ifdef HAVE_ZSTD
-            _dataBlock.compressLevel = percentToRange(level, 0, ZSTD_maxCLevel());
+            return percentToRange(level, 0, ZSTD_maxCLevel());
 #endif
             break;
         default:
@@ -518,6 +687,13 @@ void Image::setCompression(DataBlock::CompressionCodec compression, int level)
             break;
         }
     }
+    return -1;
+}
+
+void Image::setCompression(DataBlock::CompressionCodec compression, int level)
+{
+    _dataBlock.codec = compression;
+    _dataBlock.compressLevel = compressLevelFromPercent(compression, level);
 }
 
 bool Image::byteShuffling() const
@@ -538,8 +714,8 @@ void Image::convertPixelStorageTo(PixelStorage storage)
         return;
     }
 
-    ByteArray tmp;
-    tmp.resize(_dataBlock.data.size());
+    ByteArray tmp(_dataBlock.data.allocator());
+    tmp.resizeUninitialized(_dataBlock.data.size());
     size_t size = _width*_height;
 
     switch(_sampleFormat)
@@ -641,13 +817,29 @@ size_t Image::sampleFormatSize(SampleFormat sampleFormat)
     return sizeof(UInt16);
 }
 
+class XISFReaderPrivate;
+
+/** Source of attachments shared with lazily loaded property values. While file is open data are read through
+ *  reader, after it is closed file is opened again or in memory data are referenced directly. */
+struct AttachmentSource
+{
+    XISFReaderPrivate *reader = nullptr;
+    String fileName;
+    /** Size and modification time at open, file opened again must still match */
+    uint64_t fileSize = 0;
+    std::filesystem::file_time_type fileTime;
+    ByteArray data;
+    ByteArray read(uint64_t pos, uint64_t size);
+};
+
 class XISFReaderPrivate
 {
 public:
+    ~XISFReaderPrivate();
     void open(const String &name);
     void open(const ByteArray &data);
     /** Open image from istream. This method takes ownership of *io pointer */
-    void open(std::istream *io);
+    void open(std::istream *io, bool seekable);
     /** Close opended file release all data. */
     void close();
     /** Return number of images inside file */
@@ -658,28 +850,106 @@ public:
      *  will return nullptr */
     const Image& getImage(uint32_t n, bool readPixels = true);
     const Image& getThumbnail();
+    void setAllocator(const std::shared_ptr<Allocator> &allocator);
 private:
     void readXISFHeader();
     void readSignature();
-    void parseCompression(const pugi::xml_node &node, DataBlock &dataBlock);
-    DataBlock parseDataBlock(const pugi::xml_node &node);
-    Property parseProperty(const pugi::xml_node &node);
-    FITSKeyword parseFITSKeyword(const pugi::xml_node &node);
-    ColorFilterArray parseCFA(const pugi::xml_node &node);
-    Image parseImage(const pugi::xml_node &node);
+    void indexAttachment(std::string_view location);
+    void skipElement(XmlReader &xml);
+    Image parseImage(std::pair<size_t, size_t> range);
+    void parseCompression(const XmlReader &xml, DataBlock &dataBlock);
+    String parseLocation(const XmlReader &xml, DataBlock &dataBlock);
+    void parseEmbedded(XmlReader &xml, DataBlock &dataBlock);
+    DataBlock parseDataBlock(XmlReader &xml);
+    Property parseProperty(XmlReader &xml);
+    FITSKeyword parseFITSKeyword(XmlReader &xml);
+    ColorFilterArray parseCFA(XmlReader &xml);
+    Image parseImage(XmlReader &xml);
     void readAttachment(DataBlock &dataBlock);
+    ByteArray readAttachmentData(uint64_t pos, uint64_t size);
+    ByteArray readSequential(uint64_t size);
+    void skipSequential(uint64_t size);
 
     std::unique_ptr<std::istream> _io;
     std::unique_ptr<StreamBuffer> _buffer;
     std::vector<Image> _images;
     Image _thumbnail;
     std::vector<Property> _properties;
+    bool _sequential = false;
+    uint64_t _streamPos = 0;
+    std::map<uint64_t, std::pair<uint64_t, int>> _pendingAttachments;// pair contain size and reference count
+    std::map<uint64_t, ByteArray> _bufferedAttachments;
+    std::shared_ptr<Allocator> _allocator;
+    // header is kept so images are parsed only when requested, ranges are byte offsets of elements inside it
+    ByteArray _header;
+    std::vector<std::pair<size_t, size_t>> _imageRanges;
+    std::pair<size_t, size_t> _thumbnailRange;
+    std::vector<bool> _imageParsed;
+    /** Forward only stream can't read attachment again so decoded data are kept */
+    std::vector<bool> _pixelsRead;
+    bool _thumbnailPixelsRead = false;
+    bool _thumbnailParsed = false;
+    std::shared_ptr<AttachmentSource> _source;
+
+    friend struct AttachmentSource;
 };
 
+ByteArray AttachmentSource::read(uint64_t pos, uint64_t size)
+{
+    if(reader)
+        return reader->readAttachmentData(pos, size);
+
+    if(data.size())
+    {
+        if(pos > data.size() || size > data.size() - pos)
+            throw Error("Attachment is out of file bounds");
+        return data.slice(pos, size);
+    }
+
+    if(fileName.size())
+    {
+        std::error_code ec;
+        uint64_t currentSize = std::filesystem::file_size(fileName, ec);
+        std::filesystem::file_time_type currentTime;
+        if(!ec)
+            currentTime = std::filesystem::last_write_time(fileName, ec);
+        if(ec || currentSize != fileSize || currentTime != fileTime)
+            throw Error("File was changed after it was closed");
+        if(pos > fileSize || size > fileSize - pos)
+            throw Error("Attachment is out of file bounds");
+
+        std::ifstream file(fileName.c_str(), std::ios_base::in | std::ios_base::binary);
+        if(!file.seekg(pos))
+            throw Error("Failed to seek in file");
+        ByteArray ret;
+        ret.resizeUninitialized(size);
+        file.read(ret.data(), size);
+        if(file.fail())
+            throw Error("Failed to read from file");
+        return ret;
+    }
+
+    throw Error("Property attachment can't be read after stream was closed");
+}
+
+XISFReaderPrivate::~XISFReaderPrivate()
+{
+    close();
+}
+
 void XISFReaderPrivate::open(const String &name)
 {
     close();
     _io = std::make_unique<std::ifstream>(name.c_str(), std::ios_base::in | std::ios_base::binary);
+    _source = std::make_shared<AttachmentSource>();
+    _source->reader = this;
+    std::error_code ec;
+    _source->fileSize = std::filesystem::file_size(name, ec);
+    if(!ec)
+        _source->fileTime = std::filesystem::last_write_time(name, ec);
+    // file that can't be checked for changes isn't opened again after close
+    if(!ec)
+        _source->fileName = name;
     readSignature();
     readXISFHeader();
 }
@@ -689,24 +959,46 @@ void XISFReaderPrivate::open(const ByteArray &data)
     close();
     _buffer = std::make_unique<StreamBuffer>(data);
     _io = std::make_unique<std::istream>(_buffer.get());
+    _source = std::make_shared<AttachmentSource>();
+    _source->reader = this;
+    _source->data = data;
     readSignature();
     readXISFHeader();
 }
 
-void XISFReaderPrivate::open(std::istream *io)
+void XISFReaderPrivate::open(std::istream *io, bool seekable)
 {
     close();
     _io.reset(io);
+    _sequential = !seekable;
+    _source = std::make_shared<AttachmentSource>();
+    _source->reader = this;
     readSignature();
     readXISFHeader();
 }
 
 void XISFReaderPrivate::close()
 {
+    // property values that were not loaded yet keep source alive
+    if(_source)
+        _source->reader = nullptr;
+    _source.reset();
     _io.reset();
     _buffer.reset();
     _images.clear();
     _properties.clear();
+    _sequential = false;
+    _streamPos = 0;
+    _pendingAttachments.clear();
+    _bufferedAttachments.clear();
+    _header = ByteArray();
+    _imageRanges.clear();
+    _thumbnailRange = {0, 0};
+    _imageParsed.clear();
+    _pixelsRead.clear();
+    _thumbnail = Image();
+    _thumbnailParsed = false;
+    _thumbnailPixelsRead = false;
 }
 
 int XISFReaderPrivate::imagesCount() const
@@ -720,51 +1012,112 @@ const Image& XISFReaderPrivate::getImage(uint32_t n, bool readPixels)
         throw Error("Out of bounds");
 
     Image &img = _images[n];
-    if(img._dataBlock.attachmentPos && readPixels)
+    if(!_imageParsed[n])
+    {
+        img = parseImage(_imageRanges[n]);
+        _imageParsed[n] = true;
+    }
+
+    if(img._dataBlock.attachmentPos && readPixels && !(_sequential && _pixelsRead[n]))
     {
         readAttachment(img._dataBlock);
+        _pixelsRead[n] = true;
     }
     return img;
 }
 
 const Image &XISFReaderPrivate::getThumbnail()
 {
+    if(!_thumbnailParsed)
+    {
+        // thumbnail of whole file take precedence over thumbnail of last image that has one
+        std::pair<size_t, size_t> range = _thumbnailRange;
+        for(auto i = _imageRanges.rbegin(); i != _imageRanges.rend() && range.second == 0; i++)
+        {
+            XmlReader xml(_header.constData() + i->first, _header.constData() + i->second);
+            xml.next();
+            while(xml.nextChild())
+            {
+                if(xml.token() == XmlReader::StartElement && xml.name() == "Thumbnail")
+                {
+                    range.first = i->first + xml.tokenOffset();
+                    xml.skipElement();
+                    range.second = i->first + xml.offset();
+                    break;
+                }
+                else if(xml.token() == XmlReader::StartElement)
+                    xml.skipElement();
+            }
+        }
+
+        if(range.second)
+            _thumbnail = parseImage(range);
+        _thumbnailParsed = true;
+    }
+
     Image &img = _thumbnail;
-    if(_thumbnail._dataBlock.attachmentPos)
+    if(_thumbnail._dataBlock.attachmentPos && !(_sequential && _thumbnailPixelsRead))
     {
-        _io->seekg(img._dataBlock.attachmentPos);
-        ByteArray data(img._dataBlock.attachmentSize);
-        _io->read(data.data(), data.size());
-        img._dataBlock.decompress(data);
+        readAttachment(img._dataBlock);
+        _thumbnailPixelsRead = true;
     }
     return _thumbnail;
 }
 
+void XISFReaderPrivate::setAllocator(const std::shared_ptr<Allocator> &allocator)
+{
+    _allocator = allocator;
+}
+
 void XISFReaderPrivate::readXISFHeader()
 {
     uint32_t headerLen[2] = {0};
     _io->read((char*)&headerLen, sizeof(headerLen));
 
-    ByteArray xisfHeader(headerLen[0]);
-    _io->read(xisfHeader.data(), headerLen[0]);
+    _header = ByteArray();
+    _header.resizeUninitialized(headerLen[0]);
+    _io->read(_header.data(), headerLen[0]);
+    _streamPos = sizeof(headerLen) + 8 + headerLen[0];
 
-    pugi::xml_document doc;
-    doc.load_buffer(xisfHeader.data(), xisfHeader.size());
+    XmlReader xml(_header.constData(), _header.constData() + _header.size());
+    while(xml.next() == XmlReader::Text);
 
-    pugi::xml_node root = doc.child("xisf");
+    if(xml.token() != XmlReader::StartElement || xml.name() != "xisf" || xml.attribute("version") != "1.0")
+        throw Error("Unknown root XML element");
 
-    if(root && root.attribute("version").as_string() == std::string("1.0"))
+    // images and thumbnail are only indexed here and parsed on first access
+    while(xml.nextChild())
     {
-        for(auto &image : root.children("Image"))
-            _images.push_back(parseImage(image));
+        if(xml.token() != XmlReader::StartElement)
+            continue;
 
-        for(auto &property : root.children("Property"))
-            _properties.push_back(parseProperty(property));
-
-        if(root.child("Thumbnail"))
-            _thumbnail = parseImage(root.child("Thumbnail"));
+        if(xml.name() == "Image" || xml.name() == "Thumbnail")
+        {
+            std::pair<size_t, size_t> range;
+            range.first = xml.tokenOffset();
+            bool thumbnail = xml.name() == "Thumbnail";
+            skipElement(xml);
+            range.second = xml.offset();
+            if(thumbnail)
+                _thumbnailRange = range;
+            else
+                _imageRanges.push_back(range);
+        }
+        else if(xml.name() == "Property")
+        {
+            if(_sequential)
+                indexAttachment(xml.attribute("location"));
+            _properties.push_back(parseProperty(xml));
+        }
+        else
+        {
+            skipElement(xml);
+        }
     }
-    else throw Error("Unknown root XML element");
+
+    _images.resize(_imageRanges.size());
+    _imageParsed.resize(_imageRanges.size(), false);
+    _pixelsRead.resize(_imageRanges.size(), false);
 }
 
 void XISFReaderPrivate::readSignature()
@@ -778,9 +1131,53 @@ void XISFReaderPrivate::readSignature()
         throw Error("Not valid XISF 1.0 file");
 }
 
-void XISFReaderPrivate::parseCompression(const pugi::xml_node &node, DataBlock &dataBlock)
+void XISFReaderPrivate::indexAttachment(std::string_view locationStr)
 {
-    std::vector<std::string> compression = splitString(node.attribute("compression").as_string(), ':');
+    if(locationStr.substr(0, 11) != "attachment:")
+        return;
+
+    std::vector<std::string> location = splitString(std::string(locationStr), ':');
+    if(location.size() >= 3)
+    {
+        auto &pending = _pendingAttachments[parseUInt64(location[1])];
+        pending.first = parseUInt64(location[2]);
+        pending.second++;
+    }
+}
+
+void XISFReaderPrivate::skipElement(XmlReader &xml)
+{
+    if(!_sequential)
+    {
+        xml.skipElement();
+        return;
+    }
+
+    // sequential reading needs to know about every attachment in advance
+    indexAttachment(xml.attribute("location"));
+    int depth = 1;
+    while(depth > 0)
+    {
+        if(!xml.nextChild())
+            depth--;
+        else if(xml.token() == XmlReader::StartElement)
+        {
+            indexAttachment(xml.attribute("location"));
+            depth++;
+        }
+    }
+}
+
+Image XISFReaderPrivate::parseImage(std::pair<size_t, size_t> range)
+{
+    XmlReader xml(_header.constData() + range.first, _header.constData() + range.second);
+    xml.next();
+    return parseImage(xml);
+}
+
+void XISFReaderPrivate::parseCompression(const XmlReader &xml, DataBlock &dataBlock)
+{
+    std::vector<std::string> compression = splitString(std::string(xml.attribute("compression")), ':');
     if(compression.size() >= 2)
     {
         if(compression[0].find("zlib") == 0)
@@ -796,36 +1193,36 @@ void XISFReaderPrivate::parseCompression(const pugi::xml_node &node, DataBlock &
         else
             throw Error("Unknown compression codec");
 
-        dataBlock.uncompressedSize = std::stoull(compression[1]);
+        dataBlock.uncompressedSize = parseUInt64(compression[1]);
 
         if(compression[0].find("+sh") != std::string::npos)
         {
             if(compression.size() == 3)
-                dataBlock.byteShuffling = std::stoi(compression[2]);
+                dataBlock.byteShuffling = parseUInt64(compression[2]);
             else
                 throw Error("Missing byte shuffling size");
         }
 
-        if(node.attribute("subblocks"))
+        if(xml.hasAttribute("subblocks"))
         {
-            std::vector<std::string> subblocks = splitString(node.attribute("subblocks").as_string(), ':');
+            std::vector<std::string> subblocks = splitString(std::string(xml.attribute("subblocks")), ':');
             for(auto &block : subblocks)
             {
                 size_t pos = 0;
-                size_t comp = std::stoull(block, &pos);
-                size_t deco = std::stoull(block.substr(pos+1));
+                size_t comp = parseUInt64(block, &pos);
+                size_t deco = parseUInt64(block.substr(pos+1));
                 dataBlock.subblocks.push_back({comp, deco});
             }
         }
     }
 }
 
-DataBlock XISFReaderPrivate::parseDataBlock(const pugi::xml_node &node)
+/** Parse location and compression attributes of current element. Return encoding of inline data */
+String XISFReaderPrivate::parseLocation(const XmlReader &xml, DataBlock &dataBlock)
 {
-    DataBlock dataBlock;
-    std::vector<std::string> location = splitString(node.attribute("location").as_string(), ':');
+    std::vector<std::string> location = splitString(std::string(xml.attribute("location")), ':');
 
-    parseCompression(node, dataBlock);
+    parseCompression(xml, dataBlock);
 
     if(location.size() && location[0] == "embedded")
     {
@@ -833,316 +1230,951 @@ DataBlock XISFReaderPrivate::parseDataBlock(const pugi::xml_node &node)
     }
     else if(location.size() >= 2 && location[0] == "inline")
     {
-        ByteArray text(node.text().as_string());
-        dataBlock.decompress(text, location[1]);
+        return location[1];
     }
     else if(location.size() >= 3 && location[0] == "attachment")
     {
-        dataBlock.attachmentPos = std::stoull(location[1]);
-        dataBlock.attachmentSize = std::stoull(location[2]);
+        dataBlock.attachmentPos = parseUInt64(location[1]);
+        dataBlock.attachmentSize = parseUInt64(location[2]);
     }
     else
     {
         throw Error("Invalid data block");
     }
+    return String();
+}
+
+/** Read Data child element of embedded data block */
+void XISFReaderPrivate::parseEmbedded(XmlReader &xml, DataBlock &dataBlock)
+{
+    parseCompression(xml, dataBlock);
+    String encoding(xml.attribute("encoding"));
+    dataBlock.decompress(decodeText(xml.readText(), encoding));
+}
+
+DataBlock XISFReaderPrivate::parseDataBlock(XmlReader &xml)
+{
+    DataBlock dataBlock;
+    String encoding = parseLocation(xml, dataBlock);
+    bool decoded = false;
 
-    if(dataBlock.embedded)
+    while(xml.nextChild())
     {
-        auto dataNode = node.child("Data");
-        if(dataNode)
+        if(xml.token() == XmlReader::Text)
+        {
+            if(encoding.size() && !decoded)
+            {
+                dataBlock.decompress(decodeText(xml.text(), encoding));
+                decoded = true;
+            }
+        }
+        else if(xml.name() == "Data" && dataBlock.embedded && !decoded)
         {
-            parseCompression(dataNode, dataBlock);
-            String encoding = dataNode.attribute("encoding").as_string();
-            ByteArray text(dataNode.text().as_string());
-            dataBlock.decompress(text, encoding);
+            parseEmbedded(xml, dataBlock);
+            decoded = true;
         }
         else
-            throw Error("Unexpected XML element");
+            xml.skipElement();
     }
 
+    if(dataBlock.embedded && !decoded)
+        throw Error("Unexpected XML element");
+    if(encoding.size() && !decoded)
+        dataBlock.decompress(ByteArray());
+
     return dataBlock;
 }
 
-Property XISFReaderPrivate::parseProperty(const pugi::xml_node &node)
+Property XISFReaderPrivate::parseProperty(XmlReader &xml)
 {
     Property property;
 
-    property.id = node.attribute("id").as_string();
-    property.comment = node.attribute("comment").as_string();
-    ByteArray data;
-    if(node.attribute("location"))
+    property.id = xml.attribute("id");
+    property.comment = xml.attribute("comment");
+    Variant::Type typeId = variantType(xml.attribute("type"));
+    std::pair<size_t, size_t> dim = variantDimensions(xml, typeId);
+
+    if(xml.hasAttribute("location"))
     {
-        DataBlock dataBlock = parseDataBlock(node);
+        DataBlock dataBlock = parseDataBlock(xml);
+        // attachment is read and decompressed only when value is accessed
         if(dataBlock.attachmentPos)
-            readAttachment(dataBlock);
-
-        data = dataBlock.data;
+        {
+            std::shared_ptr<AttachmentSource> source = _source;
+            deserializeVariant(property.value, typeId, dim, [source, dataBlock]() mutable
+            {
+                dataBlock.decompress(source->read(dataBlock.attachmentPos, dataBlock.attachmentSize));
+                return dataBlock.data;
+            });
+        }
+        else
+        {
+            deserializeVariant(property.value, typeId, dim, dataBlock.data);
+        }
+    }
+    else if(typeId == Variant::Type::String)
+    {
+        property.value.setValue(String(xml.readText()));
+    }
+    else
+    {
+        if(xml.hasAttribute("value"))
+            deserializeVariant(property.value, typeId, xml.attribute("value"));
+        xml.skipElement();
     }
-
-    deserializeVariant(node, property.value, data);
 
     return property;
 }
 
-FITSKeyword XISFReaderPrivate::parseFITSKeyword(const pugi::xml_node &node)
+FITSKeyword XISFReaderPrivate::parseFITSKeyword(XmlReader &xml)
 {
     FITSKeyword fitsKeyword;
-    fitsKeyword.name = node.attribute("name").as_string();
-    fitsKeyword.value = node.attribute("value").as_string();
-    fitsKeyword.comment = node.attribute("comment").as_string();
+    fitsKeyword.name = xml.attribute("name");
+    fitsKeyword.value = xml.attribute("value");
+    fitsKeyword.comment = xml.attribute("comment");
+    xml.skipElement();
     return fitsKeyword;
 }
 
-ColorFilterArray XISFReaderPrivate::parseCFA(const pugi::xml_node &node)
+ColorFilterArray XISFReaderPrivate::parseCFA(XmlReader &xml)
 {
     ColorFilterArray cfa;
-    if(node.attribute("pattern") && node.attribute("width") && node.attribute("height"))
+    if(xml.hasAttribute("pattern") && xml.hasAttribute("width") && xml.hasAttribute("height"))
     {
-        cfa.pattern = node.attribute("pattern").as_string();
-        cfa.width = node.attribute("width").as_int();
-        cfa.height = node.attribute("height").as_int();
+        cfa.pattern = xml.attribute("pattern");
+        cfa.width = std::atoi(String(xml.attribute("width")).c_str());
+        cfa.height = std::atoi(String(xml.attribute("height")).c_str());
     }
     else
     {
         throw Error("ColorFilterArray element missing one of mandatory attributes");
     }
+    xml.skipElement();
     return cfa;
 }
 
-Image XISFReaderPrivate::parseImage(const pugi::xml_node &node)
+Image XISFReaderPrivate::parseImage(XmlReader &xml)
 {
     Image image;
 
-    std::vector<std::string> geometry = splitString(node.attribute("geometry").as_string(), ':');
+    std::vector<std::string> geometry = splitString(std::string(xml.attribute("geometry")), ':');
     if(geometry.size() != 3)throw Error("We support only 2D images");
-    image._width = std::stoull(geometry[0]);
-    image._height = std::stoull(geometry[1]);
-    image._channelCount = std::stoull(geometry[2]);
+    image._width = parseUInt64(geometry[0]);
+    image._height = parseUInt64(geometry[1]);
+    image._channelCount = parseUInt64(geometry[2]);
     if(!image._width || !image._height || !image._channelCount)throw Error("Invalid image geometry");
 
-    std::vector<std::string> bounds = splitString(node.attribute("bounds").as_string(), ':');
+    std::vector<std::string> bounds = splitString(std::string(xml.attribute("bounds")), ':');
     if(bounds.size() == 2)
     {
-        image._bounds.first = std::stod(bounds[0]);
-        image._bounds.second = std::stod(bounds[1]);
+        image._bounds.first = parseDouble(bounds[0]);
+        image._bounds.second = parseDouble(bounds[1]);
+    }
+    image._imageType = Image::imageTypeEnum(String(xml.attribute("imageType")));
+    image._pixelStorage = Image::pixelStorageEnum(String(xml.attribute("pixelStorage")));
+    image._sampleFormat = Image::sampleFormatEnum(String(xml.attribute("sampleFormat")));
+    image._colorSpace = Image::colorSpaceEnum(String(xml.attribute("colorSpace")));
+
+    DataBlock &dataBlock = image._dataBlock;
+    String encoding = parseLocation(xml, dataBlock);
+    bool decoded = false;
+
+    // children are handled in single pass in document order
+    while(xml.nextChild())
+    {
+        if(xml.token() == XmlReader::Text)
+        {
+            if(encoding.size() && !decoded)
+            {
+                dataBlock.decompress(decodeText(xml.text(), encoding));
+                decoded = true;
+            }
+            continue;
+        }
+
+        std::string_view name = xml.name();
+        if(name == "Property")
+            image.appendProperty(parseProperty(xml));
+        else if(name == "FITSKeyword")
+            image.appendFITSKeyword(parseFITSKeyword(xml));
+        else if(name == "ColorFilterArray")
+            image._cfa = parseCFA(xml);
+        else if(name == "ICCProfile")
+        {
+            DataBlock icc = parseDataBlock(xml);
+            if(icc.attachmentPos)
+                readAttachment(icc);
+
+            image._iccProfile = icc.data;
+        }
+        else if(name == "Data" && dataBlock.embedded && !decoded)
+        {
+            parseEmbedded(xml, dataBlock);
+            decoded = true;
+        }
+        else
+            xml.skipElement();
     }
-    image._imageType = Image::imageTypeEnum(node.attribute("imageType").as_string());
-    image._pixelStorage = Image::pixelStorageEnum(node.attribute("pixelStorage").as_string());
-    image._sampleFormat = Image::sampleFormatEnum(node.attribute("sampleFormat").as_string());
-    image._colorSpace = Image::colorSpaceEnum(node.attribute("colorSpace").as_string());
 
-    image._dataBlock = parseDataBlock(node);
+    if(dataBlock.embedded && !decoded)
+        throw Error("Unexpected XML element");
+    if(encoding.size() && !decoded)
+        dataBlock.decompress(ByteArray());
 
-    for(auto &property : node.children("Property"))
-        image._properties.push_back(parseProperty(property));
+    return image;
+}
 
-    for(auto &fitsKeyword : node.children("FITSKeyword"))
-        image._fitsKeywords.push_back(parseFITSKeyword(fitsKeyword));
+void XISFReaderPrivate::readAttachment(DataBlock &dataBlock)
+{
+    ByteArray data = readAttachmentData(dataBlock.attachmentPos, dataBlock.attachmentSize);
+    dataBlock.decompress(data);
+}
 
-    if(node.child("ColorFilterArray"))
-        image._cfa = parseCFA(node.child("ColorFilterArray"));
+ByteArray XISFReaderPrivate::readAttachmentData(uint64_t pos, uint64_t size)
+{
+    // file is already in memory so just reference its part
+    if(_buffer)
+    {
+        ByteArray file = _buffer->byteArray();
+        if(pos > file.size() || size > file.size() - pos)
+            throw Error("Attachment is out of file bounds");
+        return file.slice(pos, size);
+    }
 
-    if(node.child("ICCProfile"))
+    if(!_sequential)
     {
-        DataBlock icc = parseDataBlock(node.child("ICCProfile"));
-        if(icc.attachmentPos)
-            readAttachment(icc);
+        _io->seekg(pos);
+        return readSequential(size);
+    }
 
-        image._iccProfile = icc.data;
+    auto buffered = _bufferedAttachments.find(pos);
+    if(buffered != _bufferedAttachments.end())
+    {
+        ByteArray data = buffered->second;
+        auto pending = _pendingAttachments.find(pos);
+        if(pending == _pendingAttachments.end() || --pending->second.second <= 0)
+        {
+            _bufferedAttachments.erase(buffered);
+            _pendingAttachments.erase(pos);
+        }
+        return data;
     }
 
-    if(node.child("Thumbnail") && std::strcmp(node.name(), "Thumbnail"))
-        _thumbnail = parseImage(node.child("Thumbnail"));
+    if(pos < _streamPos)
+        throw Error("Attachment was already consumed from sequential stream");
 
-    return image;
+    // keep blocks that we skip over so they can be requested later
+    for(auto i = _pendingAttachments.begin(); i != _pendingAttachments.end() && i->first < pos; )
+    {
+        if(i->first >= _streamPos)
+        {
+            skipSequential(i->first - _streamPos);
+            _bufferedAttachments[i->first] = readSequential(i->second.first);
+            i++;
+        }
+        else if(!_bufferedAttachments.count(i->first))
+            i = _pendingAttachments.erase(i);
+        else
+            i++;
+    }
+
+    skipSequential(pos - _streamPos);
+    ByteArray data = readSequential(size);
+
+    auto pending = _pendingAttachments.find(pos);
+    if(pending != _pendingAttachments.end() && --pending->second.second > 0)
+        _bufferedAttachments[pos] = data;
+    else
+        _pendingAttachments.erase(pos);
+
+    return data;
 }
 
-void XISFReaderPrivate::readAttachment(DataBlock &dataBlock)
+ByteArray XISFReaderPrivate::readSequential(uint64_t size)
 {
-    ByteArray data(dataBlock.attachmentSize);
-    _io->seekg(dataBlock.attachmentPos);
-    size_t size = dataBlock.attachmentSize;
+    ByteArray data(_allocator);
+    data.resizeUninitialized(size);
     char *ptr = data.data();
     while(size > 0)
     {
-        size_t s = std::min(size, GiB);
+        size_t s = std::min(size, (uint64_t)GiB);
         _io->read(ptr, s);
+        if(_io->fail())
+            throw Error("Failed to read from file");
         size -= s;
         ptr += s;
     }
-    dataBlock.decompress(data);
+    _streamPos += data.size();
+    return data;
 }
 
-class  XISFWriterPrivate
+void XISFReaderPrivate::skipSequential(uint64_t size)
 {
-public:
-    void save(const String &name);
-    void save(ByteArray &data);
-    void save(std::ostream &io);
-    void writeImage(const Image &image);
-    static void writeFITSKeyword(pugi::xml_node &node, const FITSKeyword &keyword);
-private:
-    void writeHeader();
-    void writeImageElement(pugi::xml_node &node, const Image &image);
-    void writeDataBlockAttributes(pugi::xml_node &image_node, const DataBlock &dataBlock);
-    void writePropertyElement(pugi::xml_node &node, const Property &property);
-    void writeMetadata(pugi::xml_node &node);
-    void updateImageAttachmentPos(pugi::xml_node &root, size_t offset);
-    ByteArray _xisfHeader;
-    ByteArray _attachmentsData;
-    std::vector<Image> _images;
-};
+    if(size && _io->ignore(size).fail())
+        throw Error("Failed to read from file");
+    _streamPos += size;
+}
 
-void XISFWriterPrivate::save(const String &name)
+/** XISF header whose numbers are filled in after its size is known. Attachment positions are relative to end of
+ *  header so their digit count depends on header size. Size is found as numeric fixpoint without emitting XML again */
+struct HeaderLayout
 {
-    std::ofstream fw(name.c_str(), std::ios_base::out | std::ios_base::binary);
+    struct Slot
+    {
+        size_t pos;
+        uint64_t value;
+        bool relative;
+    };
 
-    if(fw.fail())
-        throw Error("Failed to open file");
+    std::string xml;
+    std::vector<Slot> slots;
+    /** Pad all numbers to this width, zero means shortest form */
+    int width = 0;
 
-    save(fw);
-}
+    void addSlot(bool relative) { slots.push_back({xml.size(), 0, relative}); }
+    uint64_t size() const;
+    /** Return signature followed by XML with numbers filled in */
+    ByteArray build(uint64_t size) const;
+};
 
-void XISFWriterPrivate::save(ByteArray &data)
+static int digitCount(uint64_t value)
 {
-    StreamBuffer buffer;
-    std::ostream oss(&buffer);
-    save(oss);
-    data = buffer.byteArray();
+    int count = 1;
+    for(; value >= 10; value /= 10)
+        count++;
+    return count;
 }
 
-void XISFWriterPrivate::save(std::ostream &io)
+/** Smallest header size consistent with decimal length of positions relative to its end.
+ *  Size grows only when numbers get more digits so iteration from lower bound stops at it. */
+static uint64_t headerSizeFixpoint(uint64_t base, const std::vector<uint64_t> &relative)
 {
-    writeHeader();
+    uint64_t size = 0;
+    while(true)
+    {
+        uint64_t next = base;
+        for(uint64_t value : relative)
+            next += digitCount(value + size);
+        if(next == size)
+            return size;
+        size = next;
+    }
+}
 
-    io.write(_xisfHeader.constData(), _xisfHeader.size());
+uint64_t HeaderLayout::size() const
+{
+    uint64_t base = 16 + xml.size();
+    if(width)
+        return base + slots.size() * width;
 
-    for(auto &image : _images)
+    std::vector<uint64_t> relative;
+    for(auto &slot : slots)
     {
-        const char *ptr = image._dataBlock.data.constData();
-        size_t size = image._dataBlock.data.size();
-        while(size > 0)
-        {
+        if(slot.relative)
+            relative.push_back(slot.value);
+        else
+            base += digitCount(slot.value);
+    }
+    return headerSizeFixpoint(base, relative);
+}
+
+ByteArray HeaderLayout::build(uint64_t size) const
+{
+    ByteArray header;
+    header.resizeUninitialized(size);
+    char *ptr = header.data();
+    char *end = ptr + size;
+    uint32_t xmlSize = size - 16;
+    std::memcpy(ptr, "XISF0100", 8);
+    std::memcpy(ptr + 8, &xmlSize, sizeof(xmlSize));
+    std::memset(ptr + 12, 0, 4);
+    ptr += 16;
+
+    size_t last = 0;
+    for(auto &slot : slots)
+    {
+        if((size_t)(end - ptr) < slot.pos - last)
+            throw Error("XISF header size changed during save");
+
+        std::memcpy(ptr, xml.data() + last, slot.pos - last);
+        ptr += slot.pos - last;
+        last = slot.pos;
+
+        char str[24];
+        uint64_t value = slot.value + (slot.relative ? size : 0);
+        size_t digits = std::to_chars(str, str + sizeof(str), value).ptr - str;
+        size_t padding = width > (int)digits ? width - digits : 0;
+        if((size_t)(end - ptr) < padding + digits)
+            throw Error("XISF header size changed during save");
+
+        std::memset(ptr, '0', padding);
+        std::memcpy(ptr + padding, str, digits);
+        ptr += padding + digits;
+    }
+
+    if(end - ptr != (ptrdiff_t)(xml.size() - last))
+        throw Error("XISF header size changed during save");
+    std::memcpy(ptr, xml.data() + last, xml.size() - last);
+    return header;
+}
+
+/** Data blocks produce same attachment and header attributes */
+static bool sameDataBlock(const DataBlock &a, const DataBlock &b)
+{
+    return a.codec == b.codec && a.compressLevel == b.compressLevel && a.byteShuffling == b.byteShuffling &&
+            a.uncompressedSize == b.uncompressedSize && a.subblocks == b.subblocks && a.data.size() == b.data.size() &&
+            (a.data.size() == 0 || std::memcmp(a.data.constData(), b.data.constData(), a.data.size()) == 0);
+}
+
+class  XISFWriterPrivate
+{
+public:
+    void save(const String &name);
+    void save(ByteArray &data);
+    void save(std::ostream &io);
+    void save(int fd);
+    void writeImage(const Image &image);
+    void setSinglePassLayout(bool enable);
+    void setThreadCount(int count);
+    void setAllocator(const std::shared_ptr<Allocator> &allocator);
+    void setAttachmentThreshold(size_t threshold, DataBlock::CompressionCodec codec, int level);
+private:
+    void buildHeader(HeaderLayout &layout);
+    void fillAttachmentSlots(HeaderLayout &layout);
+    void writeHeader();
+    void compressPending();
+    void saveParallel(int fd);
+    bool fixedWidthLayout() const;
+    void addPropertyAttachments(const Image &image);
+    template<typename BlockAt>
+    static size_t findDuplicate(std::unordered_multimap<size_t, size_t> &hashes, size_t index, const DataBlock &dataBlock, BlockAt blockAt);
+    uint64_t propertyAttachmentsSize() const;
+    void writeImageElement(XmlWriter &xml, HeaderLayout &layout, size_t index);
+    void writeDataBlockAttributes(XmlWriter &xml, HeaderLayout &layout, const DataBlock &dataBlock);
+    void writePropertyElement(XmlWriter &xml, const Property &property);
+    void writeFITSKeyword(XmlWriter &xml, const FITSKeyword &keyword);
+    void writeMetadata(XmlWriter &xml);
+    bool isReserved(const String &name) const;
+    void writeReservedValue(XmlWriter &xml, const String &name, Variant::Type type, std::string_view value);
+
+    /** Property or ICC profile of image written as attachment instead of inline base64 */
+    struct PropertyAttachment
+    {
+        size_t image;
+        /** Index of property, ICC profile has index equal to number of properties */
+        size_t property;
+        std::pair<size_t, size_t> dim;
+        DataBlock dataBlock;
+        /** Index of attachment with same content whose data are written instead */
+        size_t source;
+    };
+
+    /** Value attribute of keyword or property followed by whitespace, used by HeaderTemplate */
+    struct ReservedField
+    {
+        String name;
+        /** Monostate for FITS keywords */
+        Variant::Type type;
+        /** Position in HeaderLayout::xml */
+        size_t pos;
+    };
+
+    ByteArray _xisfHeader;
+    ByteArray _attachmentsData;
+    std::vector<Image> _images;
+    std::vector<bool> _pendingCompression;
+    /** Index of image with same data block whose data are written instead */
+    std::vector<size_t> _imageSource;
+    std::unordered_multimap<size_t, size_t> _imageHashes;
+    std::unordered_multimap<size_t, size_t> _attachmentHashes;
+    bool _singlePassLayout = false;
+    int _threadCount = 1;
+    std::shared_ptr<Allocator> _allocator;
+    size_t _attachmentThreshold = 0;
+    DataBlock _attachmentCompression;
+    std::vector<PropertyAttachment> _propertyAttachments;
+    std::vector<String> _variable;
+    size_t _reserve = 0;
+    std::vector<ReservedField> _reservedFields;
+
+    friend class HeaderTemplatePrivate;
+};
+
+/** pugixml writer that only count size of serialized document */
+class SizeCounter : public pugi::xml_writer
+{
+public:
+    void write(const void *data, size_t size) override { (void)data; _size += size; }
+    size_t size() const { return _size; }
+private:
+    size_t _size = 0;
+};
+
+class StringWriter : public pugi::xml_writer
+{
+public:
+    explicit StringWriter(std::string &str) : _str(str) {}
+    void write(const void *data, size_t size) override { _str.append(static_cast<const char*>(data), size); }
+private:
+    std::string &_str;
+};
+
+void XISFWriterPrivate::save(const String &name)
+{
+    int fd = openForWrite(name);
+    try
+    {
+        save(fd);
+    }
+    catch(...)
+    {
+        closeFile(fd);
+        throw;
+    }
+
+    if(!closeFile(fd))
+        throw Error("Failed to write to file");
+}
+
+void XISFWriterPrivate::save(ByteArray &data)
+{
+    writeHeader();
+
+    size_t size = _xisfHeader.size() + propertyAttachmentsSize();
+    for(auto &image : _images)
+        size += image._dataBlock.data.size();
+
+    data = ByteArray(_allocator);
+    data.resizeUninitialized(size);
+    char *ptr = data.data();
+    std::memcpy(ptr, _xisfHeader.constData(), _xisfHeader.size());
+    ptr += _xisfHeader.size();
+
+    for(auto &image : _images)
+    {
+        if(image._dataBlock.data.size())
+            std::memcpy(ptr, image._dataBlock.data.constData(), image._dataBlock.data.size());
+        ptr += image._dataBlock.data.size();
+    }
+
+    for(auto &attachment : _propertyAttachments)
+    {
+        if(attachment.dataBlock.data.size())
+            std::memcpy(ptr, attachment.dataBlock.data.constData(), attachment.dataBlock.data.size());
+        ptr += attachment.dataBlock.data.size();
+    }
+}
+
+void XISFWriterPrivate::save(std::ostream &io)
+{
+    writeHeader();
+
+    io.write(_xisfHeader.constData(), _xisfHeader.size());
+
+    auto write = [&io](const ByteArray &data)
+    {
+        const char *ptr = data.constData();
+        size_t size = data.size();
+        while(size > 0)
+        {
             size_t s = std::min(size, GiB);
             io.write(ptr, s);
             ptr += s;
             size -= s;
         }
+    };
+
+    for(auto &image : _images)
+        write(image._dataBlock.data);
+
+    for(auto &attachment : _propertyAttachments)
+        write(attachment.dataBlock.data);
+}
+
+void XISFWriterPrivate::save(int fd)
+{
+#ifndef _WIN32
+    if(_threadCount > 1)
+        return saveParallel(fd);
+#endif
+
+    writeHeader();
+
+    std::vector<IOBuffer> buffers;
+    buffers.reserve(_images.size() + _propertyAttachments.size() + 1);
+    buffers.push_back({_xisfHeader.constData(), _xisfHeader.size()});
+    for(auto &image : _images)
+    {
+        if(image._dataBlock.data.size())
+            buffers.push_back({image._dataBlock.data.constData(), image._dataBlock.data.size()});
+    }
+
+    for(auto &attachment : _propertyAttachments)
+    {
+        if(attachment.dataBlock.data.size())
+            buffers.push_back({attachment.dataBlock.data.constData(), attachment.dataBlock.data.size()});
     }
+
+    writeVectored(fd, buffers);
 }
 
 void XISFWriterPrivate::writeImage(const Image &image)
 {
     _images.push_back(image);
     _images.back()._dataBlock.attachmentPos = 1;
-    _images.back()._dataBlock.compress(image.sampleFormatSize(image.sampleFormat()));
+    // with worker threads compression is deferred to save() so it can run in parallel
+    _pendingCompression.push_back(_threadCount > 1);
+    if(!_pendingCompression.back())
+        _images.back()._dataBlock.compress(image.sampleFormatSize(image.sampleFormat()));
+
+    // identical block is written only once, pending blocks are compared before compression which is deterministic
+    const size_t index = _images.size() - 1;
+    const bool pending = _pendingCompression.back();
+    _imageSource.push_back(findDuplicate(_imageHashes, index, _images.back()._dataBlock, [this, pending](size_t i) -> const DataBlock*
+    {
+        return _pendingCompression[i] == pending ? &_images[i]._dataBlock : nullptr;
+    }));
+    if(_imageSource.back() != index)
+    {
+        _images.back()._dataBlock.data = ByteArray();
+        _pendingCompression.back() = false;
+    }
+
+    if(_attachmentThreshold)
+        addPropertyAttachments(image);
 }
 
-void XISFWriterPrivate::writeHeader()
+void XISFWriterPrivate::setSinglePassLayout(bool enable)
 {
-    const char signature[16] = {'X', 'I', 'S', 'F', '0', '1', '0', '0', 0, 0, 0, 0, 0, 0, 0, 0};
+    _singlePassLayout = enable;
+}
 
-    pugi::xml_document doc;
-    doc.append_child(pugi::node_comment).set_value("\nExtensible Image Serialization Format - XISF version 1.0\nCreated with libXISF - https://nouspiro.space\n");
+void XISFWriterPrivate::setThreadCount(int count)
+{
+    _threadCount = std::max(count, 1);
+}
 
-    pugi::xml_node root = doc.append_child("xisf");
-    root.append_attribute("version").set_value("1.0");
-    root.append_attribute("xmlns").set_value("http://www.pixinsight.com/xisf");
-    root.append_attribute("xmlns:xsi").set_value("http://www.w3.org/2001/XMLSchema-instance");
-    root.append_attribute("xsi:schemaLocation").set_value("http://www.pixinsight.com/xisf http://pixinsight.com/xisf/xisf-1.0.xsd");
+void XISFWriterPrivate::setAllocator(const std::shared_ptr<Allocator> &allocator)
+{
+    _allocator = allocator;
+}
+
+void XISFWriterPrivate::setAttachmentThreshold(size_t threshold, DataBlock::CompressionCodec codec, int level)
+{
+    _attachmentThreshold = threshold;
+    _attachmentCompression.codec = codec;
+    _attachmentCompression.compressLevel = compressLevelFromPercent(codec, level);
+}
 
-    for(Image &image : _images)
+/** Move vector and matrix properties and ICC profile larger than threshold into separate data blocks */
+void XISFWriterPrivate::addPropertyAttachments(const Image &image)
+{
+    const size_t index = _images.size() - 1;
+    auto add = [&](size_t property, std::pair<size_t, size_t> dim, ByteArray &&data, int itemSize)
     {
-        writeImageElement(root, image);
+        PropertyAttachment attachment{index, property, dim, _attachmentCompression, _propertyAttachments.size()};
+        attachment.dataBlock.data = std::move(data);
+        attachment.dataBlock.compress(itemSize);
+        attachment.source = findDuplicate(_attachmentHashes, attachment.source, attachment.dataBlock, [this](size_t i)
+        {
+            return &_propertyAttachments[i].dataBlock;
+        });
+        if(attachment.source != _propertyAttachments.size())
+            attachment.dataBlock.data = ByteArray();
+        _propertyAttachments.push_back(std::move(attachment));
+    };
+
+    for(size_t i = 0; i < image._properties.size(); i++)
+    {
+        const Variant &value = image._properties[i].value;
+        std::pair<size_t, size_t> dim;
+        ByteArray data;
+        if(serializeVariant(value, dim, data) && data.size() > _attachmentThreshold)
+        {
+            int itemSize = data.size() / (dim.first * std::max<size_t>(dim.second, 1));
+            add(i, dim, std::move(data), itemSize);
+        }
     }
 
-    writeMetadata(root);
+    if(image._iccProfile.size() > _attachmentThreshold)
+        add(image._properties.size(), {0, 0}, ByteArray(image._iccProfile), 1);
+}
+
+/** Return index of earlier data block with same content or index of new block when there is none.
+ *  blockAt returns nullptr for blocks that can't be shared */
+template<typename BlockAt>
+size_t XISFWriterPrivate::findDuplicate(std::unordered_multimap<size_t, size_t> &hashes, size_t index, const DataBlock &dataBlock, BlockAt blockAt)
+{
+    size_t hash = std::hash<std::string_view>()(std::string_view(dataBlock.data.constData(), dataBlock.data.size()));
+    auto range = hashes.equal_range(hash);
+    for(auto i = range.first; i != range.second; i++)
+    {
+        const DataBlock *block = blockAt(i->second);
+        if(block && sameDataBlock(*block, dataBlock))
+            return i->second;
+    }
 
-    uint32_t size = 0;
-    std::string header;
-    while(true)
+    hashes.emplace(hash, index);
+    return index;
+}
+
+uint64_t XISFWriterPrivate::propertyAttachmentsSize() const
+{
+    uint64_t size = 0;
+    for(auto &attachment : _propertyAttachments)
+        size += attachment.dataBlock.data.size();
+    return size;
+}
+
+void XISFWriterPrivate::compressPending()
+{
+    runParallel(_threadCount, _images.size(), [this](size_t i)
     {
-        std::stringstream xml;
-        xml.write(signature, sizeof(signature));
-        doc.save(xml, "", pugi::format_raw);
-        header = xml.str();
-        if(size != header.size())
+        if(_pendingCompression[i])
+            _images[i]._dataBlock.compress(Image::sampleFormatSize(_images[i]._sampleFormat));
+    });
+    _pendingCompression.assign(_images.size(), false);
+}
+
+#ifndef _WIN32
+void XISFWriterPrivate::saveParallel(int fd)
+{
+    const size_t count = _images.size();
+
+    // header must have same structure as after compression, only numbers are different
+    for(size_t i = 0; i < count; i++)
+    {
+        DataBlock &dataBlock = _images[i]._dataBlock;
+        if(!_pendingCompression[i])
+            continue;
+
+        applyCompressionOverride(dataBlock, Image::sampleFormatSize(_images[i]._sampleFormat));
+        dataBlock.uncompressedSize = dataBlock.data.size();
+        dataBlock.subblocks.clear();
+        uint64_t subblockSize = maxSubblockSize(dataBlock.codec);
+        for(uint64_t pos = 0; subblockSize && pos < dataBlock.uncompressedSize; pos += subblockSize)
+            dataBlock.subblocks.push_back({0, std::min(subblockSize, dataBlock.uncompressedSize - pos)});
+    }
+
+    // numbers have fixed width so header size is known before compression
+    HeaderLayout layout;
+    layout.width = FixedWidthDigits;
+    buildHeader(layout);
+    const uint64_t headerSize = layout.size();
+
+    uint64_t estimatedSize = headerSize + propertyAttachmentsSize();
+    for(auto &image : _images)
+        estimatedSize += image._dataBlock.data.size();
+    preallocate(fd, estimatedSize);
+
+    // attachment can be written as soon as all preceding ones are compressed
+    std::mutex mutex;
+    size_t placed = 0;
+    std::vector<bool> done(count, false);
+    std::vector<uint64_t> offsets(count + 1, headerSize);
+    runParallel(_threadCount, count, [&](size_t i)
+    {
+        if(_pendingCompression[i])
+            _images[i]._dataBlock.compress(Image::sampleFormatSize(_images[i]._sampleFormat));
+
+        std::vector<size_t> ready;
         {
-            size = header.size();
-            updateImageAttachmentPos(root, size);
+            std::lock_guard<std::mutex> lock(mutex);
+            done[i] = true;
+            for(; placed < count && done[placed]; placed++)
+            {
+                offsets[placed + 1] = offsets[placed] + _images[placed]._dataBlock.data.size();
+                ready.push_back(placed);
+            }
         }
-        else
+
+        for(size_t r : ready)
         {
-            break;
+            const ByteArray &data = _images[r]._dataBlock.data;
+            if(data.size())
+                writeAt(fd, data.constData(), data.size(), offsets[r]);
         }
+    });
+    _pendingCompression.assign(count, false);
+
+    uint64_t end = offsets[count];
+    for(auto &attachment : _propertyAttachments)
+    {
+        const ByteArray &data = attachment.dataBlock.data;
+        if(data.size())
+            writeAt(fd, data.constData(), data.size(), end);
+        end += data.size();
     }
 
-    uint32_t headerSize = header.size() - sizeof(signature);
-    header.replace(8, sizeof(uint32_t), (const char*)&headerSize, sizeof(uint32_t));
+    fillAttachmentSlots(layout);
+    _xisfHeader = layout.build(headerSize);
+
+    writeAt(fd, _xisfHeader.constData(), _xisfHeader.size(), 0);
+    truncateFile(fd, end);
+}
+#endif
+
+bool XISFWriterPrivate::fixedWidthLayout() const
+{
+    return _singlePassLayout || _threadCount > 1;
+}
+
+void XISFWriterPrivate::buildHeader(HeaderLayout &layout)
+{
+    XmlWriter xml(layout.xml);
+    xml.raw("<?xml version=\"1.0\"?>");
+    xml.comment("\nExtensible Image Serialization Format - XISF version 1.0\nCreated with libXISF - https://nouspiro.space\n");
+
+    xml.startElement("xisf");
+    xml.attribute("version", "1.0");
+    xml.attribute("xmlns", "http://www.pixinsight.com/xisf");
+    xml.attribute("xmlns:xsi", "http://www.w3.org/2001/XMLSchema-instance");
+    xml.attribute("xsi:schemaLocation", "http://www.pixinsight.com/xisf http://pixinsight.com/xisf/xisf-1.0.xsd");
+
+    for(size_t i = 0; i < _images.size(); i++)
+    {
+        writeImageElement(xml, layout, i);
+    }
 
-    _xisfHeader = ByteArray(header.c_str(), header.size());
+    writeMetadata(xml);
+    xml.endElement();
+    fillAttachmentSlots(layout);
 }
 
-void XISFWriterPrivate::writeImageElement(pugi::xml_node &node, const Image &image)
+/** Set slot values from current data blocks. Order of slots is same as in writeDataBlockAttributes().
+ *  Property attachments follow image data but their slots are among slots of their image */
+void XISFWriterPrivate::fillAttachmentSlots(HeaderLayout &layout)
 {
-    pugi::xml_node image_node = node.append_child("Image");
+    size_t slot = 0;
+    auto fill = [&](const DataBlock &dataBlock, uint64_t offset)
+    {
+        layout.slots[slot++].value = offset;
+        layout.slots[slot++].value = dataBlock.data.size();
+        for(auto &subblock : dataBlock.subblocks)
+            layout.slots[slot++].value = subblock.first;
+    };
+
+    // duplicate blocks have no data and point to offset of their source
+    uint64_t offset = 0;
+    std::vector<uint64_t> imageOffsets(_images.size());
+    for(size_t i = 0; i < _images.size(); i++)
+    {
+        imageOffsets[i] = _imageSource[i] == i ? offset : imageOffsets[_imageSource[i]];
+        offset += _images[i]._dataBlock.data.size();
+    }
+
+    std::vector<uint64_t> attachmentOffsets(_propertyAttachments.size());
+    for(size_t i = 0; i < _propertyAttachments.size(); i++)
+    {
+        const PropertyAttachment &attachment = _propertyAttachments[i];
+        attachmentOffsets[i] = attachment.source == i ? offset : attachmentOffsets[attachment.source];
+        offset += attachment.dataBlock.data.size();
+    }
+
+    size_t a = 0;
+    for(size_t i = 0; i < _images.size(); i++)
+    {
+        fill(_images[_imageSource[i]]._dataBlock, imageOffsets[i]);
+        for(; a < _propertyAttachments.size() && _propertyAttachments[a].image == i; a++)
+            fill(_propertyAttachments[_propertyAttachments[a].source].dataBlock, attachmentOffsets[a]);
+    }
+}
+
+void XISFWriterPrivate::writeHeader()
+{
+    compressPending();
+
+    HeaderLayout layout;
+    layout.width = fixedWidthLayout() ? FixedWidthDigits : 0;
+    buildHeader(layout);
+    _xisfHeader = layout.build(layout.size());
+}
+
+void XISFWriterPrivate::writeImageElement(XmlWriter &xml, HeaderLayout &layout, size_t index)
+{
+    const Image &image = _images[index];
+    auto attachment = std::lower_bound(_propertyAttachments.begin(), _propertyAttachments.end(), index,
+                                       [](const PropertyAttachment &a, size_t i){ return a.image < i; });
+    auto isAttachment = [&](size_t property)
+    {
+        return attachment != _propertyAttachments.end() && attachment->image == index && attachment->property == property;
+    };
+
+    xml.startElement("Image");
     std::string geometry = std::to_string(image._width) + ":" + std::to_string(image._height) + ":" + std::to_string(image._channelCount);
-    image_node.append_attribute("geometry").set_value(geometry.c_str());
-    image_node.append_attribute("sampleFormat").set_value(Image::sampleFormatString(image._sampleFormat).c_str());
-    image_node.append_attribute("colorSpace").set_value(Image::colorSpaceString(image._colorSpace).c_str());
-    image_node.append_attribute("imageType").set_value(Image::imageTypeString(image._imageType).c_str());
-    image_node.append_attribute("pixelStorage").set_value(Image::pixelStorageString(image._pixelStorage).c_str());
+    xml.attribute("geometry", geometry);
+    xml.attribute("sampleFormat", Image::sampleFormatString(image._sampleFormat));
+    xml.attribute("colorSpace", Image::colorSpaceString(image._colorSpace));
+    xml.attribute("imageType", Image::imageTypeString(image._imageType));
+    xml.attribute("pixelStorage", Image::pixelStorageString(image._pixelStorage));
     if((image._sampleFormat == Image::Float32 || image._sampleFormat == Image::Float64) ||
             image._bounds.first != 0.0 || image._bounds.second != 1.0)
     {
         std::string bounds = std::to_string(image._bounds.first) + ":" + std::to_string(image._bounds.second);
-        image_node.append_attribute("bounds").set_value(bounds.c_str());
+        xml.attribute("bounds", bounds);
     }
 
-    writeDataBlockAttributes(image_node, image._dataBlock);
-    for(auto &property : image._properties)
-        writePropertyElement(image_node, property);
+    writeDataBlockAttributes(xml, layout, _images[_imageSource[index]]._dataBlock);
+    for(size_t i = 0; i < image._properties.size(); i++)
+    {
+        const Property &property = image._properties[i];
+        if(isAttachment(i))
+        {
+            xml.startElement("Property");
+            xml.attribute("id", property.id);
+            xml.attribute("type", property.value.typeName());
+            serializeVariantDimensions(xml, property.value.type(), attachment->dim);
+            writeDataBlockAttributes(xml, layout, _propertyAttachments[attachment->source].dataBlock);
+            if(!property.comment.empty())
+                xml.attribute("comment", property.comment);
+            xml.endElement();
+            attachment++;
+        }
+        else
+        {
+            writePropertyElement(xml, property);
+        }
+    }
 
     for(auto &fitsKeyword : image._fitsKeywords)
-        writeFITSKeyword(image_node, fitsKeyword);
+        writeFITSKeyword(xml, fitsKeyword);
 
     if(image._cfa.width && image._cfa.height)
     {
-        pugi::xml_node cfa_node = image_node.append_child("ColorFilterArray");
-        cfa_node.append_attribute("pattern").set_value(image._cfa.pattern.c_str());
-        cfa_node.append_attribute("width").set_value(image._cfa.width);
-        cfa_node.append_attribute("height").set_value(image._cfa.height);
+        xml.startElement("ColorFilterArray");
+        xml.attribute("pattern", image._cfa.pattern);
+        xml.attribute("width", (uint64_t)image._cfa.width);
+        xml.attribute("height", (uint64_t)image._cfa.height);
+        xml.endElement();
     }
 
-    if(image._iccProfile.size())
+    if(isAttachment(image._properties.size()))
+    {
+        xml.startElement("ICCProfile");
+        writeDataBlockAttributes(xml, layout, _propertyAttachments[attachment->source].dataBlock);
+        xml.endElement();
+    }
+    else if(image._iccProfile.size())
     {
         ByteArray base64 = image._iccProfile;
         base64.encodeBase64();
-        base64.append('\0');
-        pugi::xml_node icc_node = image_node.append_child("ICCProfile");
-        icc_node.append_attribute("location").set_value("inline:base64");
-        icc_node.append_child(pugi::node_pcdata).set_value(base64.data());
+        xml.startElement("ICCProfile");
+        xml.attribute("location", "inline:base64");
+        xml.text(std::string_view(base64.constData(), base64.size()));
+        xml.endElement();
     }
+    xml.endElement();
 }
 
-void XISFWriterPrivate::writeDataBlockAttributes(pugi::xml_node &image_node, const DataBlock &dataBlock)
+void XISFWriterPrivate::writeDataBlockAttributes(XmlWriter &xml, HeaderLayout &layout, const DataBlock &dataBlock)
 {
-    if(dataBlock.embedded)
-    {
-        image_node.append_attribute("location").set_value("embedded");
-    }
-    else if(dataBlock.attachmentPos == 0)
-    {
-        image_node.append_attribute("location").set_value("inline:base64");
-    }
-    else
-    {
-        std::string attachment = "attachment:";
-        if(dataBlock.attachmentPos == 0) attachment += "99999";
-        else attachment += std::to_string(dataBlock.attachmentPos);
-        attachment += ":" + std::to_string(dataBlock.data.size());
-        image_node.append_attribute("location").set_value(attachment.c_str());
-    }
+    // position and sizes are filled by fillAttachmentSlots()
+    xml.startAttribute("location");
+    xml.raw("attachment:");
+    layout.addSlot(true);
+    xml.raw(":");
+    layout.addSlot(false);
+    xml.endAttribute();
 
     std::string codec;
 
@@ -1168,62 +2200,350 @@ void XISFWriterPrivate::writeDataBlockAttributes(pugi::xml_node &image_node, con
         if(dataBlock.byteShuffling > 1)
             codec += ":" + std::to_string(dataBlock.byteShuffling);
 
-        image_node.append_attribute("compression").set_value(codec.c_str());
+        xml.attribute("compression", codec);
     }
 
     if(!dataBlock.subblocks.empty())
     {
-        std::string subblocks;
+        xml.startAttribute("subblocks");
         for(auto i = dataBlock.subblocks.begin(); i != dataBlock.subblocks.end(); i++)
         {
             if(i != dataBlock.subblocks.begin())
-                subblocks += ":";
+                xml.raw(":");
 
-            subblocks += std::to_string(i->first) + "," + std::to_string(i->second);
+            layout.addSlot(false);
+            xml.raw("," + std::to_string(i->second));
         }
-        image_node.append_attribute("subblocks").set_value(subblocks.c_str());
+        xml.endAttribute();
     }
 }
 
-void XISFWriterPrivate::writePropertyElement(pugi::xml_node &node, const Property &property)
+void XISFWriterPrivate::writePropertyElement(XmlWriter &xml, const Property &property)
 {
-    pugi::xml_node property_node = node.append_child("Property");
-    property_node.append_attribute("id").set_value(property.id.c_str());
+    xml.startElement("Property");
+    xml.attribute("id", property.id);
+    if(isReserved(property.id))
+    {
+        char str[64];
+        char *end = formatScalar(property.value, str, str + sizeof(str));
+        if(!end)
+            throw Error("Only scalar property can have reserved value");
+
+        xml.attribute("type", property.value.typeName());
+        writeReservedValue(xml, property.id, property.value.type(), std::string_view(str, end - str));
+        if(!property.comment.empty())
+            xml.attribute("comment", property.comment);
+    }
+    else
+    {
+        serializeVariant(xml, property.value, property.comment);
+    }
+    xml.endElement();
+}
 
-    serializeVariant(property_node, property.value);
+void XISFWriterPrivate::writeFITSKeyword(XmlWriter &xml, const FITSKeyword &keyword)
+{
+    xml.startElement("FITSKeyword");
+    xml.attribute("name", keyword.name);
+    if(isReserved(keyword.name))
+        writeReservedValue(xml, keyword.name, Variant::Type::Monostate, keyword.value);
+    else
+        xml.attribute("value", keyword.value);
+    xml.attribute("comment", keyword.comment);
+    xml.endElement();
+}
 
-    if(!property.comment.empty())
-        property_node.append_attribute("comment").set_value(property.comment.c_str());
+bool XISFWriterPrivate::isReserved(const String &name) const
+{
+    if(std::find(_variable.begin(), _variable.end(), name) == _variable.end())
+        return false;
+
+    // repeated keywords like HISTORY get slot only for first occurrence
+    for(auto &field : _reservedFields)
+        if(field.name == name)
+            return false;
+    return true;
 }
 
-void XISFWriterPrivate::writeFITSKeyword(pugi::xml_node &node, const FITSKeyword &keyword)
+void XISFWriterPrivate::writeReservedValue(XmlWriter &xml, const String &name, Variant::Type type, std::string_view value)
 {
-    pugi::xml_node fits_node = node.append_child("FITSKeyword");
-    fits_node.append_attribute("name").set_value(keyword.name.c_str());
-    fits_node.append_attribute("value").set_value(keyword.value.c_str());
-    fits_node.append_attribute("comment").set_value(keyword.comment.c_str());
+    size_t pos = xml.buffer().size();
+    xml.attribute("value", value);
+    size_t length = xml.buffer().size() - pos;
+    if(length > _reserve)
+        throw Error("Value doesn't fit into reserved space");
+
+    xml.buffer().append(_reserve - length, ' ');
+    _reservedFields.push_back({name, type, pos});
 }
 
-void XISFWriterPrivate::writeMetadata(pugi::xml_node &node)
+void XISFWriterPrivate::writeMetadata(XmlWriter &xml)
 {
-    pugi::xml_node metadata = node.append_child("Metadata");
+    xml.startElement("Metadata");
     std::time_t t = std::time(nullptr);
     std::tm tm = *std::gmtime(&t);
-    writePropertyElement(metadata, Property("XISF:CreationTime", tm));
-    writePropertyElement(metadata, Property("XISF:CreatorApplication", "LibXISF"));
+    writePropertyElement(xml, Property("XISF:CreationTime", tm));
+    writePropertyElement(xml, Property("XISF:CreatorApplication", "LibXISF"));
+    xml.endElement();
 }
 
-void XISFWriterPrivate::updateImageAttachmentPos(pugi::xml_node &root, size_t offset)
+/** Extract image information from header. Only Image elements and their FITSKeyword children are looked at */
+static std::vector<ImageInfo> probeHeader(const char *begin, const char *end, const std::vector<String> &keywords)
 {
-    pugi::xpath_node_set imageNodes = root.select_nodes("//Image");
-    int i = 0;
-    for(auto &image : _images)
+    std::vector<ImageInfo> images;
+    XmlReader xml(begin, end);
+    while(xml.next() == XmlReader::Text);
+
+    if(xml.token() != XmlReader::StartElement || xml.name() != "xisf" || xml.attribute("version") != "1.0")
+        throw Error("Unknown root XML element");
+
+    while(xml.nextChild())
     {
-        pugi::xml_node node = imageNodes[i++].node();
-        std::string location = "attachment:" + std::to_string(offset) + ":" + std::to_string(image._dataBlock.data.size());
-        offset += image._dataBlock.data.size();
-        node.attribute("location").set_value(location.c_str());
+        if(xml.token() != XmlReader::StartElement)
+            continue;
+
+        if(xml.name() != "Image")
+        {
+            xml.skipElement();
+            continue;
+        }
+
+        ImageInfo info;
+        std::vector<std::string> geometry = splitString(std::string(xml.attribute("geometry")), ':');
+        if(geometry.size() != 3)throw Error("We support only 2D images");
+        info.width = parseUInt64(geometry[0]);
+        info.height = parseUInt64(geometry[1]);
+        info.channelCount = parseUInt64(geometry[2]);
+        info.imageType = Image::imageTypeEnum(String(xml.attribute("imageType")));
+        info.sampleFormat = Image::sampleFormatEnum(String(xml.attribute("sampleFormat")));
+        info.colorSpace = Image::colorSpaceEnum(String(xml.attribute("colorSpace")));
+
+        if(keywords.empty())
+        {
+            xml.skipElement();
+        }
+        else
+        {
+            while(xml.nextChild())
+            {
+                if(xml.token() != XmlReader::StartElement)
+                    continue;
+
+                if(xml.name() == "FITSKeyword")
+                {
+                    std::string_view name = xml.attribute("name");
+                    for(auto &keyword : keywords)
+                    {
+                        if(keyword == name)
+                        {
+                            info.fitsKeywords.push_back({String(name), String(xml.attribute("value")), String(xml.attribute("comment"))});
+                            break;
+                        }
+                    }
+                }
+                xml.skipElement();
+            }
+        }
+
+        images.push_back(std::move(info));
     }
+
+    return images;
+}
+
+/** Check signature and return header length */
+static uint32_t probeSignature(const char *data, size_t size)
+{
+    if(size < 16 || std::memcmp(data, "XISF0100", 8) != 0)
+        throw Error("Not valid XISF 1.0 file");
+
+    uint32_t headerLen;
+    std::memcpy(&headerLen, data + 8, sizeof(headerLen));
+    return headerLen;
+}
+
+/** Read signature and XML header of file. Return only header bytes */
+static ByteArray readHeaderFile(const String &path)
+{
+    // most headers fit into first read so it is usually one open, read and close
+    const size_t prefixSize = 64 * 1024;
+    ByteArray data;
+    data.resizeUninitialized(prefixSize);
+
+    int fd = openForRead(path);
+    uint64_t headerEnd = 0;
+    try
+    {
+        size_t read = readFull(fd, data.data(), prefixSize);
+        headerEnd = 16 + (uint64_t)probeSignature(data.constData(), read);
+        if(headerEnd > read)
+        {
+            if(read < prefixSize)
+                throw Error("Unexpected end of file");
+            data.resizeUninitialized(headerEnd);
+            if(readFull(fd, data.data() + read, headerEnd - read) != headerEnd - read)
+                throw Error("Unexpected end of file");
+        }
+    }
+    catch(...)
+    {
+        closeFile(fd);
+        throw;
+    }
+    closeFile(fd);
+
+    return data.slice(16, headerEnd - 16);
+}
+
+std::vector<ImageInfo> XISFReader::probe(const String &path, const std::vector<String> &keywords)
+{
+    ByteArray header = readHeaderFile(path);
+    return probeHeader(header.constData(), header.constData() + header.size(), keywords);
+}
+
+std::vector<ImageInfo> XISFReader::probe(const ByteArray &data, const std::vector<String> &keywords)
+{
+    uint64_t headerEnd = 16 + (uint64_t)probeSignature(data.constData(), data.size());
+    if(headerEnd > data.size())
+        throw Error("Unexpected end of file");
+    return probeHeader(data.constData() + 16, data.constData() + headerEnd, keywords);
+}
+
+/** Convert extracted value and store it in row of column */
+static void setColumnValue(MetadataColumn &column, size_t row, std::string_view value)
+{
+    std::string text = normalizeKeywordValue(value);
+    const char *begin = text.c_str();
+    const char *end = begin + text.size();
+    if(begin < end && *begin == '+')
+        begin++;
+
+    switch(column.type)
+    {
+    case MetadataColumn::Float:
+    {
+        double number = 0;
+        auto ret = std::from_chars(begin, end, number);
+        column.valid[row] = begin < end && ret.ec == std::errc() && ret.ptr == end;
+        column.floats[row] = number;
+        break;
+    }
+    case MetadataColumn::Integer:
+    {
+        int64_t number = 0;
+        auto ret = std::from_chars(begin, end, number);
+        if(begin < end && ret.ec == std::errc() && ret.ptr == end)
+        {
+            column.integers[row] = number;
+            column.valid[row] = 1;
+            break;
+        }
+
+        // values like 300. or 3E2 are still integers
+        double real = 0;
+        auto retReal = std::from_chars(begin, end, real);
+        if(begin < end && retReal.ec == std::errc() && retReal.ptr == end && real == std::trunc(real) && std::abs(real) < 9.2e18)
+        {
+            column.integers[row] = (int64_t)real;
+            column.valid[row] = 1;
+        }
+        break;
+    }
+    case MetadataColumn::Text:
+        column.strings[row] = std::move(text);
+        column.valid[row] = 1;
+        break;
+    }
+}
+
+std::vector<MetadataColumn> XISFReader::extractColumns(const std::vector<String> &paths,
+                                                       const std::vector<std::pair<String, MetadataColumn::Type>> &columns,
+                                                       int threads)
+{
+    std::vector<MetadataColumn> result(columns.size());
+    std::unordered_map<std::string_view, size_t> columnIndex;
+    for(size_t i = 0; i < columns.size(); i++)
+    {
+        MetadataColumn &column = result[i];
+        column.name = columns[i].first;
+        column.type = columns[i].second;
+        column.valid.resize(paths.size(), 0);
+        switch(column.type)
+        {
+        case MetadataColumn::Float: column.floats.resize(paths.size(), 0.0); break;
+        case MetadataColumn::Integer: column.integers.resize(paths.size(), 0); break;
+        case MetadataColumn::Text: column.strings.resize(paths.size()); break;
+        }
+        columnIndex.emplace(columns[i].first, i);
+    }
+
+    if(threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // every file writes only its own row so no locking is needed
+    runParallel(threads, paths.size(), [&](size_t row)
+    {
+        std::vector<bool> found(result.size(), false);
+        try
+        {
+            ByteArray header = readHeaderFile(paths[row]);
+            XmlReader xml(header.constData(), header.constData() + header.size());
+            while(xml.next() == XmlReader::Text);
+            if(xml.token() != XmlReader::StartElement || xml.name() != "xisf")
+                return;
+
+            while(xml.nextChild())
+            {
+                if(xml.token() != XmlReader::StartElement)
+                    continue;
+                if(xml.name() != "Image")
+                {
+                    xml.skipElement();
+                    continue;
+                }
+
+                while(xml.nextChild())
+                {
+                    if(xml.token() != XmlReader::StartElement)
+                        continue;
+
+                    bool keyword = xml.name() == "FITSKeyword";
+                    bool property = xml.name() == "Property";
+                    auto it = keyword || property ? columnIndex.find(xml.attribute(keyword ? "name" : "id")) : columnIndex.end();
+                    if(it == columnIndex.end() || found[it->second])
+                    {
+                        xml.skipElement();
+                        continue;
+                    }
+
+                    found[it->second] = true;
+                    if(keyword || xml.hasAttribute("value"))
+                    {
+                        setColumnValue(result[it->second], row, xml.attribute("value"));
+                        xml.skipElement();
+                    }
+                    else if(xml.attribute("type") == "String" && !xml.hasAttribute("location"))
+                    {
+                        setColumnValue(result[it->second], row, xml.readText());
+                    }
+                    else
+                    {
+                        xml.skipElement();
+                    }
+                }
+                // only first image is used
+                break;
+            }
+        }
+        catch(std::exception &)
+        {
+            // unreadable file leaves whole row invalid
+            for(auto &column : result)
+                column.valid[row] = 0;
+        }
+    });
+
+    return result;
 }
 
 XISFReader::XISFReader()
@@ -1246,9 +2566,9 @@ void XISFReader::open(const ByteArray &data)
     p->open(data);
 }
 
-void XISFReader::open(std::istream *io)
+void XISFReader::open(std::istream *io, bool seekable)
 {
-    p->open(io);
+    p->open(io, seekable);
 }
 
 void XISFReader::close()
@@ -1271,6 +2591,11 @@ const Image &XISFReader::getThumbnail()
     return p->getThumbnail();
 }
 
+void XISFReader::setAllocator(const std::shared_ptr<Allocator> &allocator)
+{
+    p->setAllocator(allocator);
+}
+
 XISFWriter::XISFWriter()
 {
     p = new XISFWriterPrivate;
@@ -1296,11 +2621,187 @@ void XISFWriter::save(std::ostream &io)
     p->save(io);
 }
 
+void XISFWriter::save(int fd)
+{
+    p->save(fd);
+}
+
 void XISFWriter::writeImage(const Image &image)
 {
     p->writeImage(image);
 }
 
+void XISFWriter::setSinglePassLayout(bool enable)
+{
+    p->setSinglePassLayout(enable);
+}
+
+void XISFWriter::setThreadCount(int count)
+{
+    p->setThreadCount(count);
+}
+
+void XISFWriter::setAllocator(const std::shared_ptr<Allocator> &allocator)
+{
+    p->setAllocator(allocator);
+}
+
+void XISFWriter::setAttachmentThreshold(size_t threshold, DataBlock::CompressionCodec codec, int level)
+{
+    p->setAttachmentThreshold(threshold, codec, level);
+}
+
+class HeaderTemplatePrivate
+{
+public:
+    HeaderTemplatePrivate(const Image &prototype, const std::vector<String> &variable, size_t reserve);
+    XISFWriterPrivate::ReservedField& field(const String &name, bool keyword);
+    void setValue(const XISFWriterPrivate::ReservedField &field, std::string_view attribute);
+    void updateCreationTime();
+    void save(const String &name, const void *data);
+    void save(ByteArray &output, const void *data);
+
+    ByteArray _header;
+    std::vector<XISFWriterPrivate::ReservedField> _fields;
+    size_t _reserve = 0;
+    size_t _dataSize = 0;
+    std::string _scratch;
+};
+
+HeaderTemplatePrivate::HeaderTemplatePrivate(const Image &prototype, const std::vector<String> &variable, size_t reserve)
+{
+    XISFWriterPrivate writer;
+    writer._variable = variable;
+    writer._variable.push_back("XISF:CreationTime");
+    writer._reserve = reserve + std::strlen(" value=\"\"");
+    Image image = prototype;
+    image.setCompression(DataBlock::None);
+    image.setByteshuffling(false);
+    writer.writeImage(image);
+
+    HeaderLayout layout;
+    layout.width = FixedWidthDigits;
+    writer.buildHeader(layout);
+    _header = layout.build(layout.size());
+    _reserve = writer._reserve;
+    _dataSize = prototype.imageDataSize();
+
+    // move field positions from XML text to final header with numbers filled in
+    _fields = writer._reservedFields;
+    for(auto &field : _fields)
+    {
+        size_t slots = 0;
+        for(auto &slot : layout.slots)
+            slots += slot.pos <= field.pos;
+        field.pos += 16 + slots * FixedWidthDigits;
+    }
+
+    if(_fields.size() != variable.size() + 1)
+        throw Error("Variable keyword or property is missing in prototype image");
+}
+
+XISFWriterPrivate::ReservedField &HeaderTemplatePrivate::field(const String &name, bool keyword)
+{
+    for(auto &field : _fields)
+        if(field.name == name && (field.type == Variant::Type::Monostate) == keyword)
+            return field;
+
+    throw Error("Keyword or property doesn't have reserved value");
+}
+
+void HeaderTemplatePrivate::setValue(const XISFWriterPrivate::ReservedField &field, std::string_view attribute)
+{
+    if(attribute.size() > _reserve)
+        throw Error("Value doesn't fit into reserved space");
+
+    char *ptr = _header.data() + field.pos;
+    std::memcpy(ptr, attribute.data(), attribute.size());
+    std::memset(ptr + attribute.size(), ' ', _reserve - attribute.size());
+}
+
+void HeaderTemplatePrivate::updateCreationTime()
+{
+    std::time_t t = std::time(nullptr);
+    std::tm tm = *std::gmtime(&t);
+    char str[80] = " value=\"";
+    char *end = formatScalar(Variant(tm), str + 8, str + sizeof(str) - 1);
+    *end++ = '"';
+    setValue(field("XISF:CreationTime", false), std::string_view(str, end - str));
+}
+
+void HeaderTemplatePrivate::save(const String &name, const void *data)
+{
+    updateCreationTime();
+    int fd = openForWrite(name);
+    try
+    {
+        writeVectored(fd, {{_header.constData(), _header.size()}, {static_cast<const char*>(data), _dataSize}});
+    }
+    catch(...)
+    {
+        closeFile(fd);
+        throw;
+    }
+
+    if(!closeFile(fd))
+        throw Error("Failed to write to file");
+}
+
+void HeaderTemplatePrivate::save(ByteArray &output, const void *data)
+{
+    updateCreationTime();
+    output.resizeUninitialized(_header.size() + _dataSize);
+    std::memcpy(output.data(), _header.constData(), _header.size());
+    if(_dataSize)
+        std::memcpy(output.data() + _header.size(), data, _dataSize);
+}
+
+HeaderTemplate::HeaderTemplate(const Image &prototype, const std::vector<String> &variable, size_t reserve)
+{
+    p = new HeaderTemplatePrivate(prototype, variable, reserve);
+}
+
+HeaderTemplate::~HeaderTemplate()
+{
+    delete p;
+}
+
+void HeaderTemplate::setFITSKeyword(const String &name, const String &value)
+{
+    auto &field = p->field(name, true);
+    p->_scratch.clear();
+    XmlWriter xml(p->_scratch);
+    xml.attribute("value", value);
+    p->setValue(field, p->_scratch);
+}
+
+void HeaderTemplate::setProperty(const String &id, const Variant &value)
+{
+    auto &field = p->field(id, false);
+    if(field.type != value.type())
+        throw Error("Property value has different type than prototype");
+
+    char str[80] = " value=\"";
+    char *end = formatScalar(value, str + 8, str + sizeof(str) - 1);
+    *end++ = '"';
+    p->setValue(field, std::string_view(str, end - str));
+}
+
+void HeaderTemplate::save(const String &name, const void *data)
+{
+    p->save(name, data);
+}
+
+void HeaderTemplate::save(ByteArray &output, const void *data)
+{
+    p->save(output, data);
+}
+
+const ByteArray &HeaderTemplate::header() const
+{
+    return p->_header;
+}
+
 class XISFModifyPrivate
 {
 public:
@@ -1319,9 +2820,11 @@ public:
     void updateFITSKeyword(uint32_t image, const FITSKeyword &keyword, bool add);
     void removeFITSKeyword(uint32_t image, const String &name);
 private:
+    static void appendFITSKeyword(pugi::xml_node &node, const FITSKeyword &keyword);
     void readXISFHeader();
     void parseAttachmentPos(pugi::xml_node &root);
-    void updateAttachmentPos(pugi::xml_node &root, size_t offset);
+    void layoutAttachments(std::vector<uint64_t> &relative, std::vector<std::pair<uint64_t, uint64_t>> &blocks) const;
+    void updateAttachmentPos(pugi::xml_node &root, size_t offset, const std::vector<uint64_t> &relative);
 
     std::unique_ptr<std::istream> _io;
     std::unique_ptr<StreamBuffer> _buffer;
@@ -1361,6 +2864,8 @@ void XISFModifyPrivate::close()
     _buffer.reset();
     _root = pugi::xml_node();
     _doc.reset();
+    _attachmentPos.clear();
+    _attachmentPosNew.clear();
 }
 
 void XISFModifyPrivate::save(const String &name)
@@ -1392,24 +2897,26 @@ void XISFModifyPrivate::save(std::ostream &io)
     doc.append_child(pugi::node_comment).set_value("\nExtensible Image Serialization Format - XISF version 1.0\nCreated with libXISF - https://nouspiro.space\n");
     pugi::xml_node root_copy = doc.append_copy(_root);
 
-    uint32_t size = 0;
+    // count pass with positions relative to end of header, then find size that fits their final digits
+    std::vector<uint64_t> relative;
+    std::vector<std::pair<uint64_t, uint64_t>> blocks;
+    layoutAttachments(relative, blocks);
+    updateAttachmentPos(root_copy, 0, relative);
+    SizeCounter counter;
+    doc.save(counter, "", pugi::format_raw);
+    uint64_t base = sizeof(signature) + counter.size();
+    for(uint64_t value : relative)
+        base -= digitCount(value);
+    const uint64_t size = headerSizeFixpoint(base, relative);
+
+    updateAttachmentPos(root_copy, size, relative);
     std::string header;
-    while(true)
-    {
-        std::stringstream xml;
-        xml.write(signature, sizeof(signature));
-        doc.save(xml, "", pugi::format_raw);
-        header = xml.str();
-        if(size != header.size())
-        {
-            size = header.size();
-            updateAttachmentPos(root_copy, size);
-        }
-        else
-        {
-            break;
-        }
-    }
+    header.reserve(size);
+    header.append(signature, sizeof(signature));
+    StringWriter writer(header);
+    doc.save(writer, "", pugi::format_raw);
+    if(header.size() != size)
+        throw Error("XISF header size changed during save");
 
     uint32_t headerSize = header.size() - sizeof(signature);
     header.replace(8, sizeof(uint32_t), (const char*)&headerSize, sizeof(uint32_t));
@@ -1417,10 +2924,10 @@ void XISFModifyPrivate::save(std::ostream &io)
     io.write(header.c_str(), header.size());
     const uint64_t BLOCK_SIZE = 1024*1024*4;
     std::vector<char> data(BLOCK_SIZE);
-    for(auto &pos : _attachmentPos)
+    for(auto &block : blocks)
     {
-        uint64_t oldPos = pos.second.first;
-        uint64_t size = pos.second.second;
+        uint64_t oldPos = block.first;
+        uint64_t size = block.second;
 
         _io->seekg(oldPos);
         while(size)
@@ -1443,7 +2950,7 @@ void XISFModifyPrivate::addFITSKeyword(uint32_t image, const FITSKeyword &keywor
         throw Error("Out of bounds");
 
     pugi::xml_node imageNode = images[image].node();
-    XISFWriterPrivate::writeFITSKeyword(imageNode, keyword);
+    appendFITSKeyword(imageNode, keyword);
 }
 
 void XISFModifyPrivate::updateFITSKeyword(uint32_t image, const FITSKeyword &keyword, bool add)
@@ -1475,7 +2982,7 @@ void XISFModifyPrivate::updateFITSKeyword(uint32_t image, const FITSKeyword &key
     }
     else if(add)
     {
-        XISFWriterPrivate::writeFITSKeyword(imageNode, keyword);
+        appendFITSKeyword(imageNode, keyword);
     }
 }
 
@@ -1498,6 +3005,14 @@ void XISFModifyPrivate::removeFITSKeyword(uint32_t image, const String &name)
         imageNode.remove_child(keywordNode);
 }
 
+void XISFModifyPrivate::appendFITSKeyword(pugi::xml_node &node, const FITSKeyword &keyword)
+{
+    pugi::xml_node fits_node = node.append_child("FITSKeyword");
+    fits_node.append_attribute("name").set_value(keyword.name.c_str());
+    fits_node.append_attribute("value").set_value(keyword.value.c_str());
+    fits_node.append_attribute("comment").set_value(keyword.comment.c_str());
+}
+
 void XISFModifyPrivate::readXISFHeader()
 {
     char signature[8];
@@ -1511,7 +3026,8 @@ void XISFModifyPrivate::readXISFHeader()
     uint32_t headerLen[2] = {0};
     _io->read((char*)&headerLen, sizeof(headerLen));
 
-    ByteArray xisfHeader(headerLen[0]);
+    ByteArray xisfHeader;
+    xisfHeader.resizeUninitialized(headerLen[0]);
     _io->read(xisfHeader.data(), headerLen[0]);
 
     _doc.load_buffer(xisfHeader.data(), xisfHeader.size());
@@ -1534,24 +3050,42 @@ void XISFModifyPrivate::parseAttachmentPos(pugi::xml_node &root)
         std::vector<std::string> location = splitString(locationStr, ':');
         if(location.size() >= 3 && location[0] == "attachment")
         {
-            uint64_t attachmentPos = std::stoull(location[1]);
-            uint64_t attachmentSize = std::stoull(location[2]);
+            uint64_t attachmentPos = parseUInt64(location[1]);
+            uint64_t attachmentSize = parseUInt64(location[2]);
             _attachmentPos[i] = {attachmentPos, attachmentSize};
         }
         i++;
     }
 }
 
-void XISFModifyPrivate::updateAttachmentPos(pugi::xml_node &root, size_t offset)
+/** Compute new position of each attachment reference relative to end of header. References to same attachment,
+ *  for example deduplicated data blocks, share one copy. blocks receive original position and size of copied attachments */
+void XISFModifyPrivate::layoutAttachments(std::vector<uint64_t> &relative, std::vector<std::pair<uint64_t, uint64_t>> &blocks) const
+{
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> offsets;
+    uint64_t offset = 0;
+    for(auto &pos : _attachmentPos)
+    {
+        auto inserted = offsets.emplace(pos.second, offset);
+        if(inserted.second)
+        {
+            blocks.push_back(pos.second);
+            offset += pos.second.second;
+        }
+        relative.push_back(inserted.first->second);
+    }
+}
+
+void XISFModifyPrivate::updateAttachmentPos(pugi::xml_node &root, size_t offset, const std::vector<uint64_t> &relative)
 {
     pugi::xpath_node_set locationAttributes = root.select_nodes("//@location");
+    size_t i = 0;
     for(auto &pos : _attachmentPos)
     {
         pugi::xml_attribute attr = locationAttributes[pos.first].attribute();
         uint64_t attachmentSize = pos.second.second;
-        std::string locationStr = "attachment:" + std::to_string(offset) + ":" + std::to_string(attachmentSize);
+        std::string locationStr = "attachment:" + std::to_string(offset + relative[i++]) + ":" + std::to_string(attachmentSize);
         _attachmentPosNew[pos.first] = pos.second;
-        offset += attachmentSize;
         attr.set_value(locationStr.c_str());
     }
 }
@@ -26,9 +26,11 @@
 #include <fstream>
 #include <cstring>
 #include <vector>
+#include <string_view>
 #include <cstdint>
 #include <memory>
 #include <ctime>
+#include <functional>
 
 namespace LibXISF
 {
@@ -36,31 +38,113 @@ namespace LibXISF
 class XISFReaderPrivate;
 class XISFWriterPrivate;
 class XISFModifyPrivate;
+class CatalogPrivate;
+class HeaderTemplatePrivate;
+
+/** Source of memory for ByteArray storage. Implementations must be thread safe and throw std::bad_alloc on failure */
+class LIBXISF_EXPORT Allocator
+{
+public:
+    virtual ~Allocator() = default;
+    virtual void* allocate(size_t size) = 0;
+    virtual void deallocate(void *ptr, size_t size) = 0;
+    /** Resize block returned by allocate(). First used bytes must be preserved.
+     *  Default implementation allocate new block and copy data. */
+    virtual void* reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used);
+    /** Set allocator used by ByteArray when none is specified. nullptr restore default malloc() based allocator */
+    static void setDefault(const std::shared_ptr<Allocator> &allocator);
+    static std::shared_ptr<Allocator> defaultAllocator();
+};
+
+/** Return blocks aligned to given power of two alignment, for example 64 for cache line or 4096 for page */
+class LIBXISF_EXPORT AlignedAllocator : public Allocator
+{
+    size_t _alignment;
+public:
+    explicit AlignedAllocator(size_t alignment = 64);
+    void* allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+};
+
+/** Blocks larger than threshold are mapped directly with mmap() and marked with madvise(MADV_HUGEPAGE)
+ *  so kernel back them with transparent huge pages. Smaller blocks are served as by AlignedAllocator.
+ *  On systems without huge page support it behave as page aligned allocator. */
+class LIBXISF_EXPORT HugePageAllocator : public AlignedAllocator
+{
+    size_t _threshold;
+public:
+    explicit HugePageAllocator(size_t threshold = 2 * 1024 * 1024);
+    void* allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+    void* reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used) override;
+};
+
+class BufferPoolPrivate;
+
+/** Allocator that keeps released blocks and hands them out again for requests of similar size.
+ *  When reading many images with same geometry buffers for attachments and pixel data are recycled
+ *  so steady state reading doesn't allocate large blocks. Cached blocks are freed by clear() or destructor.
+ *  @param backing allocator of new blocks, nullptr means default allocator
+ *  @param granularity requests are rounded up to multiple of it so blocks fit compressed data of varying size */
+class LIBXISF_EXPORT BufferPool : public Allocator
+{
+public:
+    explicit BufferPool(const std::shared_ptr<Allocator> &backing = nullptr, size_t granularity = 1024 * 1024);
+    ~BufferPool();
+    void* allocate(size_t size) override;
+    void deallocate(void *ptr, size_t size) override;
+    void* reallocate(void *ptr, size_t oldSize, size_t newSize, size_t used) override;
+    /** Free all cached blocks */
+    void clear();
+    /** Number of blocks that were requested from backing allocator */
+    size_t allocationCount() const;
+    /** Total size of blocks waiting for reuse */
+    size_t cachedSize() const;
+private:
+    BufferPoolPrivate *p;
+};
 
 class LIBXISF_EXPORT ByteArray
 {
-    using PtrType = std::vector<char>;
-    using Ptr = std::shared_ptr<PtrType>;
-    Ptr _data;
+    struct Buffer;
+    std::shared_ptr<Buffer> _data;
+    size_t _offset = 0;
+    size_t _size = 0;
     void makeUnique();
+    void reallocate(size_t capacity);
 public:
-    ByteArray() : ByteArray((size_t)0) {}
+    ByteArray() = default;
     explicit ByteArray(size_t size);
+    /** Create empty array which will allocate its storage from allocator. nullptr means default allocator */
+    explicit ByteArray(const std::shared_ptr<Allocator> &allocator);
+    /** Adopt memory owned by someone else without copying. release is called with ptr once no ByteArray
+     *  references it anymore. Data are modified in place only while this array is its sole user, growing it
+     *  or writing into shared copy moves data into storage from default allocator. Empty release means memory
+     *  is never freed by ByteArray and must outlive all arrays referencing it. */
+    ByteArray(char *ptr, size_t size, std::function<void(char*)> release);
     explicit ByteArray(const char *ptr);
-    ByteArray(const char *ptr, size_t size)
-    {
-        _data = std::make_shared<std::vector<char>>();
-        _data->resize(size);
-        std::memcpy(data(), ptr, size);
-    }
-    ByteArray(const ByteArray &d);
+    ByteArray(const char *ptr, size_t size);
+    ByteArray(const ByteArray &d) = default;
+    ByteArray(ByteArray &&d) noexcept;
+    ByteArray& operator=(const ByteArray &d) = default;
+    ByteArray& operator=(ByteArray &&d) noexcept;
     char& operator[](size_t i);
     const char& operator[](size_t i) const;
-    char* data() { return &_data->at(0); }
-    const char* data() const { return &_data->at(0); }
-    const char* constData() const { return &_data->at(0); }
+    /** Return pointer to data. If storage is shared with other ByteArray it is copied first */
+    char* data();
+    const char* data() const;
+    const char* constData() const;
     size_t size() const;
+    /** Resize array. New bytes are set to zero */
     void resize(size_t newsize);
+    /** Resize array without initializing new bytes. Useful when they will be overwritten anyway */
+    void resizeUninitialized(size_t newsize);
+    /** Allocate storage for at least size bytes so following resize or append doesn't reallocate */
+    void reserve(size_t size);
+    /** Return part of array. No data are copied, storage is shared until one of them is modified */
+    ByteArray slice(size_t offset, size_t size) const;
+    /** Allocator of storage. Copies made when data are detached or grown come from same allocator */
+    std::shared_ptr<Allocator> allocator() const;
     void append(char c);
     void decodeBase64();
     void encodeBase64();
@@ -142,7 +226,11 @@ class LIBXISF_EXPORT Variant
         Complex32, Complex64, String, TimePoint,
         I8Vector, UI8Vector, I16Vector, UI16Vector, I32Vector, UI32Vector, I64Vector, UI64Vector, F32Vector, F64Vector, C32Vector, C64Vector,
         I8Matrix, UI8Matrix, I16Matrix, UI16Matrix, I32Matrix, UI32Matrix, I64Matrix, UI64Matrix, F32Matrix, F64Matrix, C32Matrix, C64Matrix>;
+    struct Loader;
     StdVariant _value;
+    std::shared_ptr<Loader> _loader;
+    const StdVariant& resolve() const;
+    void takeLoaded();
 public:
     enum class Type
     {
@@ -157,12 +245,18 @@ public:
     Variant(const T &t) : _value(t) {}
     Type type() const;
     const char *typeName() const;
+    /** First access to value set by setLoader() reads it from file, which throws Error on I/O failure
+     *  or when file was changed after reader closed it. Failed load is retried on next access. */
     template<typename T>
-    T& value() { return std::get<T>(_value); }
+    T& value() { if(_loader) takeLoaded(); return std::get<T>(_value); }
     template<typename T>
-    const T& value() const { return std::get<T>(_value); }
+    const T& value() const { return std::get<T>(_loader ? resolve() : _value); }
     template<typename T>
-    void setValue(const T& val) { _value = val; }
+    void setValue(const T& val) { _value = val; _loader = nullptr; }
+    /** Defer value until it is accessed for first time. Current value only provides type() until then.
+     *  Loader runs once even when const value() is called from multiple threads, copies share loaded value. */
+    void setLoader(const std::function<Variant()> &loader);
+    bool isLoaded() const;
     String toString() const;
 };
 
@@ -199,6 +293,9 @@ struct LIBXISF_EXPORT Property
 
     Property() = default;
     Property(const Property &) = default;
+    Property(Property &&) = default;
+    Property& operator=(const Property &) = default;
+    Property& operator=(Property &&) = default;
     Property(const String &_id, const char *_value);
     template<typename T>
     Property(const String &_id, const T& _value) :
@@ -284,6 +381,7 @@ public:
     uint64_t width() const;
     uint64_t height() const;
     uint64_t channelCount() const;
+    /** Resize image. New pixel data are set to zero */
     void setGeometry(uint64_t width, uint64_t height, uint64_t channelCount);
     const Bounds &bounds() const;
     void setBounds(const Bounds &newBounds);
@@ -300,8 +398,12 @@ public:
     const std::vector<Property> &imageProperties() const;
     void addProperty(const Property &property);
     void updateProperty(const Property &property);
-    const std::vector<FITSKeyword> fitsKeywords() const;
+    /** Return property with id or nullptr when image doesn't have it. Pointer is invalidated by adding properties */
+    const Property* findProperty(std::string_view id) const;
+    const std::vector<FITSKeyword>& fitsKeywords() const;
     void addFITSKeyword(const FITSKeyword &keyword);
+    /** Return first keyword with name or nullptr when image doesn't have it. Pointer is invalidated by adding keywords */
+    const FITSKeyword* findFITSKeyword(std::string_view name) const;
     /** Add image property while doing automatic conversion of FITS name to XISF property
      *  For example OBSERVER => Observer:Name, SITELAT => Observation:Location:Latitude
     */
@@ -316,6 +418,9 @@ public:
     template<typename T>
     const T* imageData() const { return static_cast<T*>(imageData()); }
     size_t imageDataSize() const;
+    /** Set pixel data without copying. Storage is shared with data until one of them is modified.
+     *  Throws Error when size doesn't match geometry and sample format */
+    void setImageData(const ByteArray &data);
     DataBlock::CompressionCodec compression() const;
     /** Set compression type and level.
      *  @param compression define which compression algorithm to use.
@@ -353,14 +458,52 @@ private:
     DataBlock _dataBlock;
     ByteArray _iccProfile;
     ColorFilterArray _cfa;
+    void appendProperty(Property &&property);
+    void appendFITSKeyword(FITSKeyword &&keyword);
+
     std::vector<Property> _properties;
-    std::map<String, uint32_t> _propertiesId;
     std::vector<FITSKeyword> _fitsKeywords;
+    /** Open addressing hash tables of positions in _properties and _fitsKeywords. Keys are read from
+     *  stored items so index doesn't own any strings */
+    std::vector<uint32_t> _propertiesIndex;
+    std::vector<uint32_t> _fitsKeywordsIndex;
 
     friend class XISFReaderPrivate;
     friend class XISFWriterPrivate;
 };
 
+/** Basic image information returned by XISFReader::probe() */
+struct ImageInfo
+{
+    uint64_t width = 0;
+    uint64_t height = 0;
+    uint64_t channelCount = 1;
+    Image::SampleFormat sampleFormat = Image::UInt16;
+    Image::Type imageType = Image::Light;
+    Image::ColorSpace colorSpace = Image::Gray;
+    /** Requested FITS keywords in order in which they appear in file */
+    std::vector<FITSKeyword> fitsKeywords;
+};
+
+/** Typed column of values extracted by XISFReader::extractColumns(). Only array matching type is filled
+ *  and it has one item for every file */
+struct MetadataColumn
+{
+    enum Type
+    {
+        Float,
+        Integer,
+        Text
+    };
+    String name;
+    Type type = Float;
+    std::vector<double> floats;
+    std::vector<int64_t> integers;
+    std::vector<String> strings;
+    /** Zero when file doesn't contain value or it can't be converted to type of column */
+    std::vector<uint8_t> valid;
+};
+
 class LIBXISF_EXPORT XISFReader
 {
 public:
@@ -368,8 +511,12 @@ public:
     virtual ~XISFReader();
     void open(const String &name);
     void open(const ByteArray &data);
-    /** Open image from istream. This method takes ownership of *io pointer */
-    void open(std::istream *io);
+    /** Open image from istream. This method takes ownership of *io pointer
+     *  @param seekable when false stream is only read forward so pipes and sockets can be used.
+     *  Attachments are consumed in file order and blocks that are skipped over to reach requested
+     *  one are kept in memory until they are requested. Decoded pixel data of images that were already read
+     *  are kept too so getImage() can be called repeatedly. */
+    void open(std::istream *io, bool seekable = true);
     /** Close opended file release all data. */
     void close();
     /** Return number of images inside file */
@@ -384,6 +531,21 @@ public:
      * @return image thumbnail
      */
     const Image& getThumbnail();
+    /** Allocator for attachments read from file or stream. Decompressed pixel data come from same allocator.
+     *  Files opened from ByteArray reference or decompress from its storage. nullptr means default allocator */
+    void setAllocator(const std::shared_ptr<Allocator> &allocator);
+    /** Read only signature and header of file and return geometry and format of every image without
+     *  building Image objects. Properties, attachments and FITS keywords that are not listed in keywords are skipped.
+     *  Throws Error when file is not valid XISF */
+    static std::vector<ImageInfo> probe(const String &path, const std::vector<String> &keywords = {});
+    static std::vector<ImageInfo> probe(const ByteArray &data, const std::vector<String> &keywords = {});
+    /** Extract values of FITS keywords or properties from first image of every file into typed columns.
+     *  Headers are read in parallel without building Image objects. Name of column is matched against FITS
+     *  keyword names and property ids, first occurrence is used. Quotes around FITS string values are removed.
+     *  @param threads number of threads, 0 means hardware concurrency */
+    static std::vector<MetadataColumn> extractColumns(const std::vector<String> &paths,
+                                                      const std::vector<std::pair<String, MetadataColumn::Type>> &columns,
+                                                      int threads = 0);
 private:
     XISFReaderPrivate *p;
 };
@@ -396,11 +558,55 @@ public:
     void save(const String &name);
     void save(ByteArray &data);
     void save(std::ostream &io);
+    /** Write file into file descriptor. Header and all attachments are written with single writev() call
+     *  without copying them into stream buffer. Descriptor is not closed. */
+    void save(int fd);
+    /** Data block identical to block of previously written image is not stored again, both images refer to same attachment */
     void writeImage(const Image &image);
+    /** Write attachment positions as zero padded fixed width numbers so header size doesn't depend on them.
+     *  It only selects this formatting, attachments are still compressed in writeImage() as without it.
+     *  Output is always produced sequentially so it is suitable for non-seekable sinks like pipes or stdout. */
+    void setSinglePassLayout(bool enable);
+    /** When count is larger than one compression is deferred from writeImage() to save() and runs on multiple threads.
+     *  Saving to file preallocate it and each attachment is written with pwrite() at its final offset as soon as
+     *  all preceding attachments are compressed, so compression and I/O of different images overlap.
+     *  It implies fixed width layout from setSinglePassLayout() and file descriptor must be seekable. */
+    void setThreadCount(int count);
+    /** Allocator for output of save(ByteArray&). Compressed attachments use allocator of image data.
+     *  nullptr means default allocator */
+    void setAllocator(const std::shared_ptr<Allocator> &allocator);
+    /** Vector and matrix properties and ICC profile larger than threshold bytes are written as attachments
+     *  instead of inline base64 so they don't slow down parsing of header. Zero threshold keeps everything inline.
+     *  Applies to images written after this call. Compression level is in percent like in Image::setCompression() */
+    void setAttachmentThreshold(size_t threshold, DataBlock::CompressionCodec codec = DataBlock::None, int level = -1);
 private:
     XISFWriterPrivate *p;
 };
 
+/** Precompiled header for high rate writing of frames with same metadata layout. Layout is taken from prototype
+ *  image once. Value attribute of variable FITS keywords and scalar properties is followed by reserved whitespace,
+ *  so new values are filled in place and writing frame is only copy of header and pixel data.
+ *  XISF:CreationTime is updated on every save. Pixel data are stored uncompressed. */
+class LIBXISF_EXPORT HeaderTemplate
+{
+public:
+    /** @param variable names of FITS keywords or ids of scalar properties of prototype which change between frames
+     *  @param reserve maximum length of variable value after XML escaping */
+    HeaderTemplate(const Image &prototype, const std::vector<String> &variable, size_t reserve = 32);
+    virtual ~HeaderTemplate();
+    /** Throws Error when keyword is not variable or value doesn't fit into reserved space */
+    void setFITSKeyword(const String &name, const String &value);
+    /** Value must have same type as property in prototype */
+    void setProperty(const String &id, const Variant &value);
+    /** Write header followed by pixel data. Data must have same size as data of prototype */
+    void save(const String &name, const void *data);
+    void save(ByteArray &output, const void *data);
+    /** Current header including file signature */
+    const ByteArray& header() const;
+private:
+    HeaderTemplatePrivate *p;
+};
+
 class LIBXISF_EXPORT Error : public std::exception
 {
     std::string _msg;
@@ -447,6 +653,63 @@ private:
     XISFModifyPrivate *p;
 };
 
+/** Metadata of one image stored in Catalog. FITS keyword comments are not stored, string values
+ *  have enclosing quotes and trailing spaces removed. Properties are stored as text from Variant::toString(),
+ *  vector and matrix properties are omitted. Keywords and properties with same name are grouped together */
+struct CatalogEntry
+{
+    String path;
+    uint32_t imageIndex = 0;
+    ImageInfo info;
+    std::vector<std::pair<String, String>> properties;
+};
+
+/** Condition used by Catalog::query(). Key is FITS keyword name, property id or one of
+ *  imageType, width, height, channelCount, sampleFormat and colorSpace.
+ *  When both values are numbers they are compared numerically otherwise as strings. */
+struct CatalogFilter
+{
+    enum Operator
+    {
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual
+    };
+    String key;
+    Operator op = Equal;
+    String value;
+    /** Numbers that differ at most by tolerance are equal */
+    double tolerance = 0.0;
+};
+
+/** Index of image metadata of many XISF files stored in single file. Files are keyed by path, size and
+ *  modification time so update() reads only new and changed files. Queries run over index and never touch images. */
+class LIBXISF_EXPORT Catalog
+{
+public:
+    /** Load index from file when it exists. Index with unknown format is ignored and rebuilt */
+    explicit Catalog(const String &indexPath);
+    virtual ~Catalog();
+    /** Scan directory recursively for .xisf files. Changed and new files are read in parallel, entries of
+     *  deleted files are removed. Files that fail to parse are indexed without images. Return number of files that were read.
+     *  Throws Error when directory can't be scanned, index is left unchanged.
+     *  @param threads number of threads, 0 means hardware concurrency */
+    size_t update(const String &directory, int threads = 0);
+    /** Write index to file given in constructor */
+    void save() const;
+    /** Number of files in index */
+    size_t fileCount() const;
+    /** Number of images in index */
+    size_t imageCount() const;
+    /** Return images that match all filters */
+    std::vector<CatalogEntry> query(const std::vector<CatalogFilter> &filters) const;
+private:
+    CatalogPrivate *p;
+};
+
 template<typename T>
 constexpr Image::SampleFormat Image::sampleFormatEnum()
 {
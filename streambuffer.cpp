@@ -31,21 +31,28 @@ StreamBuffer::StreamBuffer(const ByteArray &byteArray) :
     _size(byteArray.size()),
     _byteArray(byteArray)
 {
+    // storage is shared with caller, put area is set only after first write detach it
+    setp(nullptr, nullptr);
     if(_byteArray.size())
     {
-        char *ptr = _byteArray.data();
+        char *ptr = const_cast<char*>(_byteArray.constData());
         setg(ptr, ptr, ptr + _size);
-        setp(ptr, ptr + _size);
     }
     else
     {
         setg(nullptr, nullptr, nullptr);
-        setp(nullptr, nullptr);
     }
 }
 
 ByteArray StreamBuffer::byteArray()
 {
+    // returned array shares storage so next write must detach again
+    if(_writable)
+    {
+        _putOffset = pptr() - pbase();
+        setp(nullptr, nullptr);
+        _writable = false;
+    }
     return _byteArray;
 }
 
@@ -57,12 +64,12 @@ StreamBuffer::pos_type StreamBuffer::seekoff(off_type off, std::ios_base::seekdi
     if(dir == std::ios_base::cur)
     {
         newoffi += gptr() - eback();
-        newoffo += pptr() - pbase();
+        newoffo += putOffset();
     }
     else if(dir == std::ios_base::end)
         newoffo = newoffi = _byteArray.size() - off;
 
-    char *ptr = _byteArray.data();
+    char *ptr = const_cast<char*>(_byteArray.constData());
     if(mode & std::ios_base::in && newoffi >= 0 && newoffi <= _size)
     {
         setg(ptr, ptr + newoffi, ptr + _size);
@@ -71,8 +78,7 @@ StreamBuffer::pos_type StreamBuffer::seekoff(off_type off, std::ios_base::seekdi
 
     if(mode & std::ios_base::out && newoffo >= 0 && newoffo <= _size)
     {
-        setp(ptr, ptr + _size);
-        pbump(newoffo);
+        setPutOffset(newoffo);
         ret = pos_type(newoffo);
     }
 
@@ -86,15 +92,12 @@ StreamBuffer::pos_type StreamBuffer::seekpos(pos_type pos, std::ios_base::openmo
 
     if(off >= 0 && off <= (off_type)_byteArray.size())
     {
-        char *ptr = _byteArray.data();
+        char *ptr = const_cast<char*>(_byteArray.constData());
         if(mode & std::ios_base::in)
             setg(ptr, ptr + pos, ptr + _size);
 
         if(mode & std::ios_base::out)
-        {
-            setp(ptr, ptr + _size);
-            pbump(pos);
-        }
+            setPutOffset(off);
 
         ret = pos;
     }
@@ -125,11 +128,12 @@ StreamBuffer::int_type StreamBuffer::underflow()
 
 std::streamsize StreamBuffer::xsputn(const char_type *s, std::streamsize n)
 {
+    makeWritable();
     off_type len = epptr() - pptr();
     if(len < n)
     {
         _size += n - len;
-        _byteArray.resize(_size);
+        _byteArray.resizeUninitialized(_size);
         update_ptrs();
     }
     std::memcpy(pptr(), s, n);
@@ -142,6 +146,15 @@ StreamBuffer::int_type StreamBuffer::overflow(int_type c)
     if(traits_type::eq_int_type(traits_type::eof(), c))
         return traits_type::eof();
 
+    makeWritable();
+    if(pptr() < epptr())
+    {
+        // put area was empty until storage was detached
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
     _byteArray.append(c);
     _size++;
     pbump(1);
@@ -149,6 +162,39 @@ StreamBuffer::int_type StreamBuffer::overflow(int_type c)
     return c;
 }
 
+void StreamBuffer::makeWritable()
+{
+    if(_writable)
+        return;
+
+    // detach storage shared with other ByteArray before writing into it
+    off_type ipos = gptr() - eback();
+    char *ptr = _byteArray.data();
+    _writable = true;
+    setg(ptr, ptr + ipos, ptr + _size);
+    setp(ptr, ptr + _size);
+    pbump(_putOffset);
+}
+
+StreamBuffer::off_type StreamBuffer::putOffset() const
+{
+    return _writable ? pptr() - pbase() : _putOffset;
+}
+
+void StreamBuffer::setPutOffset(off_type offset)
+{
+    if(_writable)
+    {
+        char *ptr = _byteArray.data();
+        setp(ptr, ptr + _size);
+        pbump(offset);
+    }
+    else
+    {
+        _putOffset = offset;
+    }
+}
+
 void StreamBuffer::update_ptrs()
 {
     off_type ipos = gptr() - eback();
@@ -41,8 +41,14 @@ protected:
     std::streamsize xsputn(const char_type *s, std::streamsize n) override;
     int_type overflow(int_type c = traits_type::eof()) override;
 private:
+    void makeWritable();
+    off_type putOffset() const;
+    void setPutOffset(off_type offset);
     void update_ptrs();
     off_type _size = 0;
+    /** Put position while put area is empty because storage is still shared */
+    off_type _putOffset = 0;
+    bool _writable = false;
     ByteArray _byteArray;
 };
 
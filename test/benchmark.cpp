@@ -19,10 +19,18 @@
 #include <iostream>
 #include <random>
 #include <chrono>
+#include <filesystem>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
 #include "libxisf.h"
 
 using namespace LibXISF;
 
+/** Number of heap allocations of whole program, see allocationcounter.cpp */
+uint64_t allocationCount();
+
 class Timer
 {
     std::chrono::high_resolution_clock clock;
@@ -151,10 +159,733 @@ void benchmarkType(float avg, float stdDev)
     }
 }
 
+void benchmarkSave()
+{
+    std::mt19937 gen;
+    std::normal_distribution<float> normalDist {500, 30};
+    std::string path = (std::filesystem::temp_directory_path() / "libxisf_benchmark.xisf").string();
+
+    XISFWriter writer;
+    Image image(2048, 2048, 1, Image::UInt16);
+    UInt32 pixels = 2048*2048;
+    for(int n = 0; n < 10; n++)
+    {
+        UInt16 *ptr = image.imageData<UInt16>();
+        for(UInt32 i=0; i < pixels; i++)
+            ptr[i] = normalDist(gen);
+        writer.writeImage(image);
+    }
+    double size = pixels * sizeof(UInt16) * 10;
+
+    Timer timer;
+    {
+        timer.start();
+        std::ofstream fw(path, std::ios_base::out | std::ios_base::binary);
+        writer.save(fw);
+        fw.close();
+        std::cout << "ostream save        \tElapsed time: " << timer.elapsed() << " " << "ms\tSpeed: "
+                  << size/1024.0/1.024/timer.elapsed() << "MiB/s" << std::endl;
+    }
+    std::filesystem::remove(path);
+    {
+        timer.start();
+        writer.save(path);
+        std::cout << "writev save         \tElapsed time: " << timer.elapsed() << " " << "ms\tSpeed: "
+                  << size/1024.0/1.024/timer.elapsed() << "MiB/s" << std::endl;
+    }
+    std::filesystem::remove(path);
+
+    for(int threads : {1, 4})
+    {
+        XISFWriter writer;
+        writer.setThreadCount(threads);
+        image.setCompression(DataBlock::LZ4);
+        image.setByteshuffling(true);
+        timer.start();
+        for(int n = 0; n < 10; n++)
+            writer.writeImage(image);
+        writer.save(path);
+        std::cout << "LZ4 SH save " << threads << " threads\tElapsed time: " << timer.elapsed() << " " << "ms\tSpeed: "
+                  << size/1024.0/1.024/timer.elapsed() << "MiB/s" << std::endl;
+        std::filesystem::remove(path);
+    }
+}
+
+void benchmarkAllocator()
+{
+    std::mt19937 gen;
+    std::normal_distribution<float> normalDist {500, 30};
+    std::string path = (std::filesystem::temp_directory_path() / "libxisf_benchmark.xisf").string();
+
+    Image image(8192, 8192, 1, Image::UInt16);
+    UInt32 pixels = 8192*8192;
+    UInt16 *ptr = image.imageData<UInt16>();
+    for(UInt32 i=0; i < pixels; i++)
+        ptr[i] = normalDist(gen);
+    image.setCompression(DataBlock::LZ4);
+    image.setByteshuffling(true);
+    XISFWriter writer;
+    writer.writeImage(image);
+    writer.save(path);
+    double size = pixels * sizeof(UInt16) * 5;
+
+    std::pair<const char*, std::shared_ptr<Allocator>> allocators[] = {
+        {"malloc allocator    ", nullptr},
+        {"aligned allocator   ", std::make_shared<AlignedAllocator>(64)},
+        {"huge page allocator ", std::make_shared<HugePageAllocator>()},
+        {"buffer pool         ", std::make_shared<BufferPool>(std::make_shared<HugePageAllocator>())}};
+
+    Timer timer;
+    for(auto &allocator : allocators)
+    {
+        XISFReader reader;
+        reader.setAllocator(allocator.second);
+        timer.start();
+        for(int n = 0; n < 5; n++)
+        {
+            reader.open(path);
+            reader.getImage(0);
+            reader.close();
+        }
+        std::cout << allocator.first << "\tElapsed time: " << timer.elapsed() << " " << "ms\tSpeed: "
+                  << size/1024.0/1.024/timer.elapsed() << "MiB/s" << std::endl;
+    }
+    std::filesystem::remove(path);
+}
+
+void benchmarkOpen()
+{
+    XISFWriter writer;
+    Image image(16, 16, 1, Image::UInt16);
+    for(int i = 0; i < 20; i++)
+    {
+        image.addProperty(Property("Property:" + std::to_string(i), (Float64)i));
+        image.addFITSKeyword({"KEY" + std::to_string(i), std::to_string(i), "Comment of keyword"});
+    }
+    for(int i = 0; i < 2000; i++)
+        writer.writeImage(image);
+    ByteArray data;
+    writer.save(data);
+
+    Timer timer;
+    timer.start();
+    XISFReader reader;
+    for(int i = 0; i < 10; i++)
+    {
+        reader.open(data);
+        reader.getImage(1000);
+    }
+    std::cout << "Open and read one image\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+    timer.start();
+    for(int i = 0; i < 10; i++)
+    {
+        reader.open(data);
+        for(int n = 0; n < reader.imagesCount(); n++)
+            reader.getImage(n, false);
+    }
+    std::cout << "Open and parse all images\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+}
+
+void benchmarkHeader()
+{
+    XISFWriter writer;
+    Image image(16, 16, 1, Image::UInt16);
+    for(int i = 0; i < 20000; i++)
+        image.addProperty(Property("Property:" + std::to_string(i), (Float64)i));
+    for(int i = 0; i < 50000; i++)
+        image.addFITSKeyword({"KEY" + std::to_string(i), "'Value " + std::to_string(i) + "'", "Comment of keyword"});
+    writer.writeImage(image);
+    ByteArray data;
+    writer.save(data);
+
+    Timer timer;
+    timer.start();
+    XISFReader reader;
+    for(int i = 0; i < 10; i++)
+    {
+        reader.open(data);
+        reader.getImage(0, false);
+    }
+    std::cout << "Streaming parser, open and build Image\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+
+    // XISFModify still loads header into pugixml DOM
+    timer.start();
+    XISFModify modify;
+    for(int i = 0; i < 10; i++)
+        modify.open(data);
+    std::cout << "pugixml DOM, load only\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+
+    const Image &loaded = reader.getImage(0, false);
+    std::vector<std::string> names;
+    for(int i = 0; i < 1000; i++)
+        names.push_back("KEY" + std::to_string(i * 50));
+
+    timer.start();
+    size_t found = 0;
+    for(auto &name : names)
+    {
+        for(auto &keyword : loaded.fitsKeywords())
+        {
+            if(keyword.name == name)
+            {
+                found++;
+                break;
+            }
+        }
+    }
+    std::cout << "1000 keyword lookups, linear scan\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+
+    timer.start();
+    for(auto &name : names)
+        found += loaded.findFITSKeyword(name) != nullptr;
+    std::cout << "1000 keyword lookups, hashed index\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+    if(found != names.size() * 2)
+        std::cout << "Lookup didn't find all keywords" << std::endl;
+}
+
+void benchmarkMetadata()
+{
+    const char *ids[] = {"Instrument:Camera:Gain", "Instrument:Camera:Name", "Instrument:Sensor:Temperature",
+                         "Instrument:ExposureTime", "Instrument:Filter:Name", "Observation:Object:Name",
+                         "Observation:Location:Latitude", "Observation:Location:Longitude"};
+    XISFWriter writer;
+    for(int i = 0; i < 2000; i++)
+    {
+        Image image(1, 1, 1, Image::UInt16);
+        for(int k = 0; k < 40; k++)
+            image.addProperty(Property(String(ids[k % 8]) + ":" + std::to_string(k / 8), (Float64)k));
+        for(int k = 0; k < 60; k++)
+            image.addFITSKeyword({"KEY" + std::to_string(k), std::to_string(i), "Comment of keyword number " + std::to_string(k)});
+        writer.writeImage(image);
+    }
+    ByteArray data;
+    writer.save(data);
+
+    Timer timer;
+    timer.start();
+    uint64_t allocations = allocationCount();
+    XISFReader reader;
+    reader.open(data);
+    for(int i = 0; i < reader.imagesCount(); i++)
+        reader.getImage(i, false);
+    allocations = allocationCount() - allocations;
+    std::cout << "Elapsed time: " << timer.elapsed() << " ms\tallocations: " << allocations << std::endl;
+}
+
+void benchmarkHeaderWrite()
+{
+    XISFWriter writer;
+    for(int i = 0; i < 10; i++)
+    {
+        Image image(64, 64, 1, Image::UInt16);
+        for(int k = 0; k < 5000; k++)
+            image.addFITSKeyword({"KEY" + std::to_string(k), "'Value " + std::to_string(k) + "'", "Comment of keyword"});
+        writer.writeImage(image);
+    }
+
+    ByteArray data;
+    Timer timer;
+    timer.start();
+    for(int i = 0; i < 10; i++)
+        writer.save(data);
+    std::cout << "XISFWriter save\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+
+    XISFModify modify;
+    modify.open(data);
+    modify.addFITSKeyword(0, {"NEWKEY", "1", ""});
+    ByteArray modified;
+    timer.start();
+    for(int i = 0; i < 10; i++)
+        modify.save(modified);
+    std::cout << "XISFModify save\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+}
+
+void benchmarkHeaderTemplate()
+{
+    Image frame(64, 64, 1, Image::UInt16);
+    for(int k = 0; k < 60; k++)
+        frame.addFITSKeyword({"KEY" + std::to_string(k), "'Value " + std::to_string(k) + "'", "Comment of keyword"});
+    frame.addFITSKeyword({"DATE-OBS", "'2024-01-01T00:00:00.000'", "Exposure start"});
+    Image base = frame;
+    frame.addFITSKeyword({"CCD-TEMP", "-10.0", "Sensor temperature"});
+    frame.addProperty(Property("Instrument:Sensor:Temperature", -10.0));
+
+    const int frames = 1000;
+    ByteArray data;
+    Timer timer;
+    timer.start();
+    for(int i = 0; i < frames; i++)
+    {
+        Image image = base;
+        image.addFITSKeyword({"CCD-TEMP", std::to_string(-10.0 + i * 0.001), "Sensor temperature"});
+        image.addProperty(Property("Instrument:Sensor:Temperature", -10.0 + i * 0.001));
+        XISFWriter writer;
+        writer.writeImage(image);
+        writer.save(data);
+    }
+    std::cout << "XISFWriter	Elapsed time: " << timer.elapsed() << " ms" << std::endl;
+
+    HeaderTemplate headerTemplate(frame, {"DATE-OBS", "CCD-TEMP", "Instrument:Sensor:Temperature"});
+    timer.start();
+    for(int i = 0; i < frames; i++)
+    {
+        headerTemplate.setFITSKeyword("CCD-TEMP", std::to_string(-10.0 + i * 0.001));
+        headerTemplate.setProperty("Instrument:Sensor:Temperature", -10.0 + i * 0.001);
+        headerTemplate.save(data, frame.imageData());
+    }
+    std::cout << "HeaderTemplate	Elapsed time: " << timer.elapsed() << " ms" << std::endl;
+}
+
+void benchmarkPropertyAttachments()
+{
+    Image image(64, 64, 1, Image::UInt16);
+    F64Vector distortion(512 * 1024);
+    for(size_t i = 0; i < distortion.size(); i++)
+        distortion[i] = std::sin(i * 0.001);
+    image.addProperty(Property("Distortion", distortion));
+
+    for(int attachment = 0; attachment < 2; attachment++)
+    {
+        XISFWriter writer;
+        if(attachment)
+            writer.setAttachmentThreshold(4096, DataBlock::Zlib);
+        writer.writeImage(image);
+        ByteArray data;
+        Timer timer;
+        timer.start();
+        writer.save(data);
+        uint64_t saveTime = timer.elapsed();
+
+        XISFReader reader;
+        timer.start();
+        for(int i = 0; i < 10; i++)
+        {
+            reader.open(data);
+            reader.getImage(0, false);
+        }
+        std::cout << (attachment ? "Attachment" : "Inline") << "\tSave: " << saveTime << " ms\tOpen: " << timer.elapsed() / 10.0
+                  << " ms\tFile size: " << data.size() / 1024 << " KiB" << std::endl;
+    }
+}
+
+void benchmarkDeduplication()
+{
+    std::mt19937 gen;
+    std::normal_distribution<float> normalDist {500, 30};
+    std::string path = (std::filesystem::temp_directory_path() / "libxisf_benchmark.xisf").string();
+
+    Image bias(2048, 2048, 1, Image::UInt16);
+    Image light(2048, 2048, 1, Image::UInt16);
+    UInt32 pixels = 2048*2048;
+    UInt16 *ptr = bias.imageData<UInt16>();
+    for(UInt32 i=0; i < pixels; i++)
+        ptr[i] = normalDist(gen);
+
+    XISFWriter writer;
+    Timer timer;
+    uint64_t writeImageTime = 0;
+    for(int n = 0; n < 10; n++)
+    {
+        ptr = light.imageData<UInt16>();
+        for(UInt32 i=0; i < pixels; i++)
+            ptr[i] = normalDist(gen);
+        timer.start();
+        writer.writeImage(light);
+        writer.writeImage(bias);
+        writeImageTime += timer.elapsed();
+    }
+
+    timer.start();
+    writer.save(path);
+    std::cout << "10 distinct and 10 identical images\twriteImage: " << writeImageTime << " ms\tsave: " << timer.elapsed()
+              << " ms\tFile size: " << std::filesystem::file_size(path) / 1024 / 1024 << " MiB" << std::endl;
+    std::filesystem::remove(path);
+}
+
+void benchmarkScalars()
+{
+    XISFWriter writer;
+    Image image(16, 16, 1, Image::UInt16);
+    std::tm tm = {12, 22, 23, 1, 2, 123, 0, 0, 0};
+    for(int i = 0; i < 50000; i++)
+    {
+        String id = "Property:" + std::to_string(i);
+        switch(i % 6)
+        {
+        case 0: image.addProperty(Property(id, (Int32)i)); break;
+        case 1: image.addProperty(Property(id, (UInt16)i)); break;
+        case 2: image.addProperty(Property(id, (Float64)i / 7.0)); break;
+        case 3: image.addProperty(Property(id, Complex64{i / 3.0, -i / 7.0})); break;
+        case 4: image.addProperty(Property(id, tm)); break;
+        case 5: image.addProperty(Property(id, (Boolean)(i & 1))); break;
+        }
+    }
+    writer.writeImage(image);
+    ByteArray data;
+
+    Timer timer;
+    timer.start();
+    for(int i = 0; i < 10; i++)
+        writer.save(data);
+    std::cout << "Write\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+
+    timer.start();
+    uint64_t allocations = allocationCount();
+    String text;
+    for(auto &property : image.imageProperties())
+        text = property.value.toString();
+    std::cout << "toString\tElapsed time: " << timer.elapsed() << " ms\tallocations: " << allocationCount() - allocations << std::endl;
+
+    timer.start();
+    XISFReader reader;
+    for(int i = 0; i < 10; i++)
+    {
+        reader.open(data);
+        reader.getImage(0, false);
+    }
+    std::cout << "Read\tElapsed time: " << timer.elapsed() / 10.0 << " ms" << std::endl;
+}
+
+void benchmarkProbe()
+{
+    const int fileCount = 2000;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "libxisf_probe";
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+
+    Image image(64, 64, 1, Image::UInt16);
+    for(int i = 0; i < 20; i++)
+        image.addProperty(Property("Property:" + std::to_string(i), (Float64)i));
+    for(int i = 0; i < 30; i++)
+        image.addFITSKeyword({"KEY" + std::to_string(i), std::to_string(i), "Comment of keyword"});
+    image.addFITSKeyword({"EXPTIME", "300", "Exposure time"});
+    image.addFITSKeyword({"FILTER", "'Ha'", "Filter"});
+    for(int i = 0; i < fileCount; i++)
+    {
+        XISFWriter writer;
+        writer.writeImage(image);
+        paths.push_back((dir / ("probe" + std::to_string(i) + ".xisf")).string());
+        writer.save(paths.back());
+    }
+
+    auto report = [&](const char *name, uint64_t elapsed)
+    {
+        std::cout << name << "\tElapsed time: " << elapsed << " ms\t" << (uint64_t)(fileCount * 60000.0 / std::max<uint64_t>(elapsed, 1)) << " files/min" << std::endl;
+    };
+
+    Timer timer;
+    timer.start();
+    XISFReader reader;
+    for(auto &path : paths)
+    {
+        reader.open(path);
+        reader.getImage(0, false);
+    }
+    reader.close();
+    report("open and getImage", timer.elapsed());
+
+    timer.start();
+    size_t found = 0;
+    for(auto &path : paths)
+        found += XISFReader::probe(path, {"EXPTIME", "FILTER"}).at(0).fitsKeywords.size();
+    report("probe             ", timer.elapsed());
+    if(found != fileCount * 2)
+        std::cout << "Probe didn't find all keywords" << std::endl;
+
+    std::filesystem::remove_all(dir);
+}
+
+void benchmarkColumns()
+{
+    const int fileCount = 2000;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "libxisf_columns";
+    std::filesystem::create_directories(dir);
+    std::vector<std::string> paths;
+
+    Image image(64, 64, 1, Image::UInt16);
+    for(int i = 0; i < 20; i++)
+        image.addProperty(Property("Property:" + std::to_string(i), (Float64)i));
+    for(int i = 0; i < 30; i++)
+        image.addFITSKeyword({"KEY" + std::to_string(i), std::to_string(i), "Comment of keyword"});
+    image.addFITSKeyword({"EXPTIME", "300", "Exposure time"});
+    image.addFITSKeyword({"CCD-TEMP", "-10.5", "Sensor temperature"});
+    image.addFITSKeyword({"FILTER", "'Ha'", "Filter"});
+    for(int i = 0; i < fileCount; i++)
+    {
+        XISFWriter writer;
+        writer.writeImage(image);
+        paths.push_back((dir / ("columns" + std::to_string(i) + ".xisf")).string());
+        writer.save(paths.back());
+    }
+
+    Timer timer;
+    timer.start();
+    std::vector<int64_t> exposure;
+    std::vector<double> temperature;
+    std::vector<std::string> filter;
+    XISFReader reader;
+    for(auto &path : paths)
+    {
+        reader.open(path);
+        for(auto &keyword : reader.getImage(0, false).fitsKeywords())
+        {
+            if(keyword.name == "EXPTIME")
+                exposure.push_back(std::stoll(keyword.value));
+            else if(keyword.name == "CCD-TEMP")
+                temperature.push_back(std::stod(keyword.value));
+            else if(keyword.name == "FILTER")
+                filter.push_back(keyword.value);
+        }
+    }
+    reader.close();
+    std::cout << "open and getImage\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+
+    std::vector<std::pair<std::string, MetadataColumn::Type>> request = {{"EXPTIME", MetadataColumn::Integer},
+                                                                          {"CCD-TEMP", MetadataColumn::Float},
+                                                                          {"FILTER", MetadataColumn::Text}};
+    timer.start();
+    std::vector<MetadataColumn> columns = XISFReader::extractColumns(paths, request, 1);
+    std::cout << "extractColumns 1 thread\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+
+    timer.start();
+    columns = XISFReader::extractColumns(paths, request);
+    std::cout << "extractColumns\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+    if(std::count(columns[2].valid.begin(), columns[2].valid.end(), 1) != fileCount)
+        std::cout << "extractColumns didn't find all values" << std::endl;
+
+    std::filesystem::remove_all(dir);
+}
+
+void benchmarkCatalog()
+{
+    const int fileCount = 2000;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "libxisf_catalog_bench";
+    std::string indexPath = (std::filesystem::temp_directory_path() / "libxisf_catalog_bench.idx").string();
+    std::filesystem::create_directories(dir);
+    std::filesystem::remove(indexPath);
+
+    const char *types[] = {"Dark", "Flat", "Light", "Bias"};
+    for(int i = 0; i < fileCount; i++)
+    {
+        Image image(64, 64, 1, Image::UInt16);
+        image.setImageType(Image::imageTypeEnum(types[i % 4]));
+        for(int k = 0; k < 30; k++)
+            image.addFITSKeyword({"KEY" + std::to_string(k), std::to_string(k), "Comment of keyword"});
+        image.addFITSKeyword({"CCD-TEMP", std::to_string(-10 - i % 3), "Sensor temperature"});
+        image.addFITSKeyword({"GAIN", std::to_string(i / 4 % 2 ? 100 : 0), "Gain"});
+        image.addFITSKeyword({"EXPTIME", std::to_string(i % 5 ? 300 : 60), "Exposure time"});
+        XISFWriter writer;
+        writer.writeImage(image);
+        writer.save((dir / ("frame" + std::to_string(i) + ".xisf")).string());
+    }
+
+    Timer timer;
+    timer.start();
+    {
+        Catalog catalog(indexPath);
+        catalog.update(dir.string());
+        catalog.save();
+    }
+    std::cout << "Initial scan\tElapsed time: " << timer.elapsed() << " ms" << std::endl;
+
+    timer.start();
+    Catalog catalog(indexPath);
+    size_t changed = catalog.update(dir.string());
+    std::cout << "Load index and rescan\tElapsed time: " << timer.elapsed() << " ms\tchanged files: " << changed << std::endl;
+
+    timer.start();
+    size_t found = 0;
+    for(int i = 0; i < 100; i++)
+        found += catalog.query({{"imageType", CatalogFilter::Equal, "Dark"},
+                                {"CCD-TEMP", CatalogFilter::Equal, "-10", 0.5},
+                                {"GAIN", CatalogFilter::Equal, "100"},
+                                {"EXPTIME", CatalogFilter::Equal, "300"}}).size();
+    std::cout << "Query\tElapsed time: " << timer.elapsed() / 100.0 << " ms\tmatches: " << found / 100 << std::endl;
+
+    std::filesystem::remove_all(dir);
+    std::filesystem::remove(indexPath);
+}
+
+// codec implementation used before vectorized one, kept for comparison
+static std::vector<char> legacyEncodeBase64(const std::vector<char> &data)
+{
+    static const char *base64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::vector<char> tmp;
+    int i = 0;
+    uint8_t sextet[4] = {0};
+    for(uint8_t c : data)
+    {
+        switch(i)
+        {
+        case 0:
+            sextet[0] |= c >> 2 & 0x3f;
+            sextet[1] |= c << 4 & 0x3f;
+            i++;
+            break;
+        case 1:
+            sextet[1] |= c >> 4 & 0x3f;
+            sextet[2] |= c << 2 & 0x3f;
+            i++;
+            break;
+        case 2:
+            sextet[2] |= c >> 6 & 0x3f;
+            sextet[3] = c & 0x3f;
+            i = 0;
+            for(int o=0; o<4; o++)
+                tmp.push_back(base64[sextet[o]]);
+            std::memset(sextet, 0, sizeof(sextet));
+            break;
+        }
+    }
+    for(int o = 0; o <= i && i; o++)
+        tmp.push_back(base64[sextet[o]]);
+
+    if(tmp.size() % 4)
+        tmp.resize(tmp.size() + 4 - (tmp.size() % 4), '=');
+    return tmp;
+}
+
+static std::vector<char> legacyDecodeBase64(const std::vector<char> &data)
+{
+    int i = 0;
+    std::vector<char> tmp;
+    uint8_t c4[4] = {0};
+    for(uint8_t c : data)
+    {
+        if(c >= 'A' && c <= 'Z')c4[i++] = c - 'A';
+        else if(c >= 'a' && c <= 'z')c4[i++] = c - 'a' + 26;
+        else if(c >= '0' && c <= '9')c4[i++] = c - '0' + 52;
+        else if(c == '+')c4[i++] = 62;
+        else if(c == '/')c4[i++] = 63;
+
+        if(i == 4)
+        {
+            tmp.push_back((c4[0] << 2) | (c4[1] >> 4));
+            tmp.push_back((c4[1] << 4) | (c4[2] >> 2));
+            tmp.push_back((c4[2] << 6) | c4[3]);
+            i = 0;
+        }
+    }
+
+    if(i > 1)tmp.push_back((c4[0] << 2) | (c4[1] >> 4));
+    if(i > 2)tmp.push_back((c4[1] << 4) | (c4[2] >> 2));
+    return tmp;
+}
+
+static std::vector<char> legacyEncodeHex(const std::vector<char> &data)
+{
+    static const char *hex = "0123456789abcdef";
+    std::vector<char> tmp(data.size() * 2);
+    for(size_t i = 0; i< data.size(); i++)
+    {
+        uint8_t t = static_cast<uint8_t>(data.at(i));
+        tmp[2*i + 0] = hex[(t & 0xf0) >> 4];
+        tmp[2*i + 1] = hex[t & 0xf];
+    }
+    return tmp;
+}
+
+static std::vector<char> legacyDecodeHex(const std::vector<char> &data)
+{
+    auto toByte = [](char c) -> char
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'A' && c <= 'F')
+            return c - '7';
+        if(c >= 'a' && c <= 'f')
+            return c - 'W';
+        return 0;
+    };
+
+    std::vector<char> tmp(data.size() / 2);
+    for(size_t i = 0; i< tmp.size(); i++)
+        tmp[i] = (toByte(data.at(i*2)) << 4) | toByte(data.at(i*2+1));
+    return tmp;
+}
+
+void benchmarkCodec()
+{
+    std::mt19937 gen;
+    const size_t size = 64 * 1024 * 1024;
+    std::vector<char> raw(size);
+    for(auto &c : raw)
+        c = gen();
+    ByteArray data(raw.data(), raw.size());
+
+    auto report = [size](const char *name, uint64_t elapsed)
+    {
+        std::cout << name << "\tElapsed time: " << elapsed << " ms\tSpeed: " << size/1024.0/1.024/std::max<uint64_t>(elapsed, 1) << "MiB/s" << std::endl;
+    };
+
+    Timer timer;
+    timer.start();
+    std::vector<char> legacyBase64 = legacyEncodeBase64(raw);
+    report("base64 encode legacy", timer.elapsed());
+    timer.start();
+    ByteArray base64 = data;
+    base64.encodeBase64();
+    report("base64 encode       ", timer.elapsed());
+    timer.start();
+    legacyDecodeBase64(legacyBase64);
+    report("base64 decode legacy", timer.elapsed());
+    timer.start();
+    base64.decodeBase64();
+    report("base64 decode       ", timer.elapsed());
+
+    timer.start();
+    std::vector<char> legacyHex = legacyEncodeHex(raw);
+    report("hex encode legacy   ", timer.elapsed());
+    timer.start();
+    ByteArray hex = data;
+    hex.encodeHex();
+    report("hex encode          ", timer.elapsed());
+    timer.start();
+    legacyDecodeHex(legacyHex);
+    report("hex decode legacy   ", timer.elapsed());
+    timer.start();
+    hex.decodeHex();
+    report("hex decode          ", timer.elapsed());
+}
+
 void benchmark()
 {
     std::cout << "UInt16 sample type" << std::endl;
     benchmarkType<UInt16>(500, 30);
     std::cout << "Float32 sample type" << std::endl;
     benchmarkType<float>(500 / 65535.0, 30 / 65535.0);
+    std::cout << "Saving 10 UInt16 images to file" << std::endl;
+    benchmarkSave();
+    std::cout << "Decoding 8192x8192 LZ4 SH UInt16 image" << std::endl;
+    benchmarkAllocator();
+    std::cout << "Opening file with 2000 images" << std::endl;
+    benchmarkOpen();
+    std::cout << "Parse header with 20000 properties and 50000 FITS keywords" << std::endl;
+    benchmarkHeader();
+    std::cout << "Writing 10 images with 5000 FITS keywords each" << std::endl;
+    benchmarkHeaderWrite();
+    std::cout << "Writing 1000 frames with 60 FITS keywords each" << std::endl;
+    benchmarkHeaderTemplate();
+    std::cout << "Image with 4 MiB vector property" << std::endl;
+    benchmarkPropertyAttachments();
+    std::cout << "Writing 2048x2048 UInt16 images with repeated data" << std::endl;
+    benchmarkDeduplication();
+    std::cout << "Write and parse header with 50000 scalar and TimePoint properties" << std::endl;
+    benchmarkScalars();
+    std::cout << "Open file with 2000 images with 40 properties and 60 FITS keywords each" << std::endl;
+    benchmarkMetadata();
+    std::cout << "Reading geometry and two keywords from 2000 files" << std::endl;
+    benchmarkProbe();
+    std::cout << "Extracting three keyword columns from 2000 files" << std::endl;
+    benchmarkColumns();
+    std::cout << "Catalog of 2000 files" << std::endl;
+    benchmarkCatalog();
+    std::cout << "Base64 and hex codec of 64 MiB" << std::endl;
+    benchmarkCodec();
+}
+
+int main()
+{
+    benchmark();
+    return 0;
 }
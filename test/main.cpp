@@ -17,14 +17,38 @@
  ************************************************************************/
 
 #include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <atomic>
 #include "libxisf.h"
 
 using namespace LibXISF;
 
-void benchmark();
-
 #define TEST(cond, msg) if(cond){ std::cerr << msg << std::endl; return 1; }
 
+/** Read only buffer without seek support to simulate pipe */
+class SequentialBuffer : public std::streambuf
+{
+    ByteArray _data;
+public:
+    explicit SequentialBuffer(const ByteArray &data) : _data(data)
+    {
+        char *ptr = _data.data();
+        setg(ptr, ptr, ptr + _data.size());
+    }
+};
+
+/** Write only buffer without seek support to simulate pipe */
+class SequentialSink : public std::streambuf
+{
+public:
+    std::string data;
+protected:
+    std::streamsize xsputn(const char_type *s, std::streamsize n) override { data.append(s, n); return n; }
+    int_type overflow(int_type c) override { data.push_back(c); return c; }
+};
+
 int main(int argc, char **argv)
 {
     try
@@ -33,6 +57,8 @@ int main(int argc, char **argv)
         {
             XISFWriter writer;
             Image image(5, 7);
+            for(int i = 0; i < 5 * 7; i++)
+                image.imageData<UInt16>()[i] = i * 997;
             image.setImageType(Image::Light);
             image.addProperty(Property("PropertyString", "Hello XISF"));
             image.addProperty(Property("PropertyBoolean", (Boolean)true));
@@ -76,9 +102,497 @@ int main(int argc, char **argv)
             const Image &img1 = reader.getImage(1);
 
             TEST(image.imageProperties().size() != img0.imageProperties().size(), "Property count doesn't match");
+            TEST(!img0.findProperty("PropertyInt16") || img0.findProperty("PropertyInt16")->value.value<Int16>() != 16, "Property lookup doesn't match");
+            TEST(!img0.findFITSKeyword("DEC") || img0.findFITSKeyword("DEC")->value != "62.02302376908295", "FITS keyword lookup doesn't match");
+            TEST(img0.findProperty("Missing") || img0.findFITSKeyword("MISSING"), "Lookup found missing entry");
+            TEST(img0.findProperty("PropertyComplex64")->value.value<Complex64>().imag != 2.0, "Complex property doesn't match");
+            TEST(img0.findProperty("PropertyFloat32")->value.toString() != "0.32" || img0.findProperty("PropertyComplex64")->value.toString() != "(-3,2)",
+                 "Shortest float format doesn't match");
+            TEST(img0.findProperty("VectorUInt16")->value.toString() != "{23,45,86}" || img0.findProperty("UI16Matrix")->value.toString() != "{{0,1,2},{10,0,0}}",
+                 "Vector or matrix format doesn't match");
+            TEST(img0.findProperty("TimeObs")->value.toString() != "3923-03-01T23:22:12Z", "TimePoint format doesn't match");
+            TEST(img0.findProperty("TimeObs")->value.value<TimePoint>().tm_hour != 23 || img0.findProperty("TimeObs")->value.value<TimePoint>().tm_year != 2023,
+                 "TimePoint property doesn't match");
+            {
+                Image indexed;
+                for(int i = 0; i < 100; i++)
+                    indexed.addFITSKeyword({"HISTORY", std::to_string(i), ""});
+                for(int i = 0; i < 100; i++)
+                    indexed.addProperty(Property("Index:" + std::to_string(i), i));
+                TEST(indexed.findFITSKeyword("HISTORY")->value != "0", "Lookup didn't return first keyword");
+                TEST(!indexed.findProperty("Index:99") || indexed.findProperty("Index:99")->value.value<Int32>() != 99, "Lookup after rehash doesn't match");
+            }
             TEST(std::memcmp(image.imageData(), img0.imageData(), image.imageDataSize()), "Images doesn't match");
             TEST(std::memcmp(image.imageData(), img1.imageData(), image.imageDataSize()), "Images doesn't match");
 
+            ByteArray slice = data.slice(16, 8);
+            TEST(slice.constData() != data.constData() + 16, "Slice copied data");
+            slice.data()[0] ^= 1;
+            TEST(slice.constData()[0] == data.constData()[16], "Modified slice changed original data");
+
+            {
+                int released = 0;
+                std::vector<char> frame(image.imageDataSize());
+                std::memcpy(frame.data(), image.imageData(), frame.size());
+                {
+                    Image adopted(image.width(), image.height(), image.channelCount(), image.sampleFormat());
+                    adopted.setImageData(ByteArray(frame.data(), frame.size(), [&released](char*){ released++; }));
+                    const Image &constAdopted = adopted;
+                    TEST(constAdopted.imageData() != frame.data(), "Adopted data were copied");
+                    XISFWriter adoptWriter;
+                    adoptWriter.writeImage(adopted);
+                    ByteArray adoptData;
+                    adoptWriter.save(adoptData);
+                    XISFReader adoptReader;
+                    adoptReader.open(adoptData);
+                    TEST(std::memcmp(frame.data(), adoptReader.getImage(0).imageData(), frame.size()), "Adopted image doesn't match");
+                    TEST(released, "Adopted data released too early");
+                }
+                TEST(released != 1, "Adopted data were not released");
+
+                // without callback memory stays owned by caller
+                char stackBuffer[64] = "stack";
+                {
+                    ByteArray borrowed(stackBuffer, sizeof(stackBuffer), nullptr);
+                    TEST(borrowed.constData() != stackBuffer, "Borrowed data were copied");
+                    ByteArray copy = borrowed;
+                    copy.data()[0] = 'S';
+                    TEST(stackBuffer[0] != 's', "Write into shared copy modified borrowed data");
+                    borrowed.append('x');
+                }
+                TEST(std::strcmp(stackBuffer, "stack"), "Borrowed data were modified");
+            }
+
+            for(size_t size = 0; size < 300; size++)
+            {
+                ByteArray raw(size);
+                for(size_t i = 0; i < size; i++)
+                    raw[i] = i * 131 + size;
+                ByteArray base64 = raw;
+                base64.encodeBase64();
+                TEST(base64.size() != (size + 2) / 3 * 4, "Invalid base64 size");
+                ByteArray wrapped;
+                for(size_t i = 0; i < base64.size(); i++)
+                {
+                    wrapped.append(base64[i]);
+                    if(i % 76 == 75)
+                        wrapped.append('\n');
+                }
+                base64.decodeBase64();
+                wrapped.decodeBase64();
+                TEST(base64.size() != size || std::memcmp(base64.constData(), raw.constData(), size), "Base64 roundtrip failed");
+                TEST(wrapped.size() != size || std::memcmp(wrapped.constData(), raw.constData(), size), "Wrapped base64 roundtrip failed");
+                ByteArray hex = raw;
+                hex.encodeHex();
+                hex.decodeHex();
+                TEST(hex.size() != size || std::memcmp(hex.constData(), raw.constData(), size), "Hex roundtrip failed");
+            }
+            ByteArray base64("TWFu");
+            base64.decodeBase64();
+            TEST(base64.size() != 3 || std::memcmp(base64.constData(), "Man", 3), "Invalid base64 decoding");
+            ByteArray hex("00FFaB17");
+            hex.decodeHex();
+            TEST(hex.size() != 4 || std::memcmp(hex.constData(), "\x00\xff\xab\x17", 4), "Invalid hex decoding");
+
+            for(DataBlock::CompressionCodec codec : {DataBlock::Zlib, DataBlock::LZ4})
+            {
+                DataBlock block;
+                block.codec = codec;
+                block.data = ByteArray(4096);
+                block.compress(1);
+                ByteArray compressed = block.data;
+                auto subblocks = block.subblocks;
+                // size claimed by header, size of subblocks and size produced by decoder must all match
+                bool rejected[3] = {false, false, false};
+                for(int i = 0; i < 3; i++)
+                {
+                    block.subblocks = subblocks;
+                    block.uncompressedSize = 4096;
+                    if(i == 0)
+                        block.uncompressedSize++;
+                    else if(i == 1)
+                        block.subblocks.back().first++;
+                    else
+                        block.uncompressedSize = ++block.subblocks.back().second;
+                    try { block.decompress(compressed); } catch(Error &) { rejected[i] = true; }
+                }
+                TEST(!rejected[0] || !rejected[1] || !rejected[2], "Inconsistent compressed block was accepted");
+                block.subblocks = subblocks;
+                block.uncompressedSize = 4096;
+                block.decompress(compressed);
+                TEST(block.data.size() != 4096 || block.data[4095] != 0, "Decompressed block doesn't match");
+            }
+
+            {
+                Image controlImage(1, 1);
+                controlImage.addFITSKeyword({"NOTE", "'a\x01z'", "tab\there\x1f"});
+                XISFWriter controlWriter;
+                controlWriter.writeImage(controlImage);
+                ByteArray controlData;
+                controlWriter.save(controlData);
+                std::string controlHeader(controlData.constData(), controlData.size());
+                TEST(controlHeader.find("value=\"'a&#01;z'\" comment=\"tab&#09;here&#31;\"") == std::string::npos, "Control characters weren't escaped");
+                XISFReader controlReader;
+                controlReader.open(controlData);
+                const FITSKeyword *note = controlReader.getImage(0).findFITSKeyword("NOTE");
+                TEST(!note || note->value != "'a\x01z'" || note->comment != "tab\there\x1f", "Escaped control characters don't match");
+            }
+
+            XISFWriter plainWriter;
+            image.setCompression(DataBlock::None);
+            image.setByteshuffling(false);
+            Image iccImage = image;
+            ByteArray icc(1000);
+            for(size_t i = 0; i < icc.size(); i++)
+                icc[i] = i * 7;
+            iccImage.setIccProfile(icc);
+            plainWriter.writeImage(iccImage);
+            ByteArray plainData;
+            plainWriter.save(plainData);
+            XISFReader plainReader;
+            plainReader.open(plainData);
+            const char *plainPixels = static_cast<const char*>(plainReader.getImage(0).imageData());
+            TEST(plainPixels < plainData.constData() || plainPixels >= plainData.constData() + plainData.size(), "Uncompressed image data were copied");
+            TEST(std::memcmp(image.imageData(), plainPixels, image.imageDataSize()), "Uncompressed images doesn't match");
+            TEST(plainReader.getImage(0).iccProfile().size() != icc.size() ||
+                 std::memcmp(plainReader.getImage(0).iccProfile().constData(), icc.constData(), icc.size()), "Inline ICC profile doesn't match");
+            image.setCompression(DataBlock::LZ4);
+            image.setByteshuffling(true);
+
+            SequentialBuffer sequentialBuffer(data);
+            reader.open(new std::istream(&sequentialBuffer), false);
+            const Image &seq1 = reader.getImage(1);
+            const Image &seq0 = reader.getImage(0);
+            TEST(std::memcmp(image.imageData(), seq0.imageData(), image.imageDataSize()), "Sequential images doesn't match");
+            TEST(std::memcmp(image.imageData(), seq1.imageData(), image.imageDataSize()), "Sequential images doesn't match");
+            TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Sequential image read again doesn't match");
+            TEST(std::memcmp(image.imageData(), reader.getImage(0).imageData(), image.imageDataSize()), "Sequential image read again doesn't match");
+            reader.close();
+
+            XISFWriter singlePassWriter;
+            singlePassWriter.setSinglePassLayout(true);
+            singlePassWriter.writeImage(image);
+            singlePassWriter.writeImage(image);
+            SequentialSink sink;
+            std::ostream sinkStream(&sink);
+            singlePassWriter.save(sinkStream);
+            SequentialBuffer singlePassBuffer(ByteArray(sink.data.c_str(), sink.data.size()));
+            reader.open(new std::istream(&singlePassBuffer), false);
+            TEST(reader.imagesCount() != 2, "Single pass layout image count doesn't match");
+            TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Single pass images doesn't match");
+            reader.close();
+
+            std::string path = (std::filesystem::temp_directory_path() / "libxisf_test.xisf").string();
+            writer.save(path);
+            reader.open(path);
+            TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Images saved to file doesn't match");
+            reader.close();
+
+            std::vector<ImageInfo> info = XISFReader::probe(path, {"DEC"});
+            TEST(info.size() != 2, "Probe image count doesn't match");
+            TEST(info[1].width != image.width() || info[1].height != image.height() || info[1].channelCount != image.channelCount(), "Probe geometry doesn't match");
+            TEST(info[0].imageType != Image::Light || info[1].imageType != Image::Flat || info[1].sampleFormat != Image::UInt16, "Probe format doesn't match");
+            TEST(info[0].fitsKeywords.size() != 1 || info[0].fitsKeywords[0].value != "62.02302376908295", "Probe keyword doesn't match");
+            TEST(XISFReader::probe(data).at(0).fitsKeywords.size(), "Probe returned keywords that were not requested");
+
+            {
+                std::filesystem::path catalogDir = std::filesystem::temp_directory_path() / "libxisf_catalog";
+                std::filesystem::remove_all(catalogDir);
+                std::filesystem::create_directories(catalogDir / "darks");
+                std::string indexPath = (std::filesystem::temp_directory_path() / "libxisf_catalog.idx").string();
+                std::filesystem::remove(indexPath);
+
+                Image frame(8, 8);
+                frame.setImageType(Image::Dark);
+                frame.addFITSKeyword({"CCD-TEMP", "-10.02", ""});
+                frame.addFITSKeyword({"GAIN", "100", ""});
+                frame.addFITSKeyword({"FILTER", "'Ha      '", ""});
+                frame.addProperty(Property("Instrument:ExposureTime", (Float32)300));
+                XISFWriter catalogWriter;
+                catalogWriter.writeImage(frame);
+                catalogWriter.save((catalogDir / "darks" / "dark.xisf").string());
+                frame.setImageType(Image::Light);
+                XISFWriter lightWriter;
+                lightWriter.writeImage(frame);
+                lightWriter.save((catalogDir / "light.xisf").string());
+
+                std::vector<MetadataColumn> columns = XISFReader::extractColumns({(catalogDir / "darks" / "dark.xisf").string(), (catalogDir / "missing.xisf").string(), (catalogDir / "light.xisf").string()},
+                                                                                 {{"CCD-TEMP", MetadataColumn::Float}, {"GAIN", MetadataColumn::Integer},
+                                                                                  {"FILTER", MetadataColumn::Text}, {"Instrument:ExposureTime", MetadataColumn::Integer},
+                                                                                  {"OBJECT", MetadataColumn::Text}}, 2);
+                TEST(columns.size() != 5 || columns[0].floats.size() != 3 || columns[2].strings.size() != 3, "Extracted column size doesn't match");
+                TEST(!columns[0].valid[0] || columns[0].floats[0] != -10.02 || !columns[1].valid[2] || columns[1].integers[2] != 100, "Extracted numeric column doesn't match");
+                TEST(columns[2].strings[0] != "Ha" || columns[3].integers[0] != 300 || !columns[3].valid[2], "Extracted text or property column doesn't match");
+                TEST(columns[0].valid[1] || columns[4].valid[0] || columns[4].valid[2], "Missing value was marked as valid");
+
+                {
+                    Catalog catalog(indexPath);
+                    TEST(catalog.update(catalogDir.string(), 2) != 2, "Catalog didn't read all files");
+                    TEST(catalog.update(catalogDir.string(), 2) != 0, "Catalog reread unchanged files");
+                    std::vector<CatalogEntry> darks = catalog.query({{"imageType", CatalogFilter::Equal, "Dark"},
+                                                                      {"CCD-TEMP", CatalogFilter::Equal, "-10", 0.5},
+                                                                      {"GAIN", CatalogFilter::Equal, "100"},
+                                                                      {"Instrument:ExposureTime", CatalogFilter::Equal, "300"}});
+                    TEST(darks.size() != 1 || darks[0].info.imageType != Image::Dark || darks[0].info.width != 8, "Catalog query doesn't match");
+                    TEST(catalog.query({{"FILTER", CatalogFilter::Equal, "Ha"}}).size() != 2, "Catalog string query doesn't match");
+                    TEST(catalog.query({{"GAIN", CatalogFilter::Greater, "100"}}).size(), "Catalog numeric query doesn't match");
+                    catalog.save();
+                }
+
+                Catalog catalog(indexPath);
+                TEST(catalog.fileCount() != 2 || catalog.imageCount() != 2, "Catalog index wasn't loaded");
+                std::filesystem::remove(catalogDir / "light.xisf");
+                frame.addFITSKeyword({"OBJECT", "'M42'", ""});
+                XISFWriter changedWriter;
+                changedWriter.writeImage(frame);
+                changedWriter.save((catalogDir / "darks" / "dark.xisf").string());
+                TEST(catalog.update(catalogDir.string()) != 1, "Catalog didn't reread changed file");
+                TEST(catalog.fileCount() != 1, "Catalog kept deleted file");
+                TEST(catalog.query({{"OBJECT", CatalogFilter::Equal, "M42"}}).size() != 1, "Catalog didn't update changed file");
+
+                ByteArray corrupt;
+                changedWriter.save(corrupt);
+                std::string corruptData(corrupt.constData(), corrupt.size());
+                corruptData.replace(corruptData.find("geometry=\"8"), 11, "geometry=\"x");
+                std::ofstream((catalogDir / "corrupt.xisf").string(), std::ios::binary) << corruptData;
+                TEST(catalog.update(catalogDir.string()) != 1, "Catalog didn't read corrupt file");
+                TEST(catalog.fileCount() != 2 || catalog.imageCount() != 1, "Catalog didn't record corrupt file as empty");
+                TEST(catalog.query({{"OBJECT", CatalogFilter::Equal, "M42"}}).size() != 1, "Catalog lost good file next to corrupt one");
+                std::filesystem::rename(catalogDir, catalogDir.string() + "_moved");
+                bool scanFailed = false;
+                try { catalog.update(catalogDir.string()); } catch(Error &) { scanFailed = true; }
+                std::filesystem::rename(catalogDir.string() + "_moved", catalogDir);
+                TEST(!scanFailed || catalog.fileCount() != 2, "Catalog dropped records after failed directory scan");
+                std::filesystem::remove_all(catalogDir);
+                std::filesystem::remove(indexPath);
+            }
+
+            reader.setAllocator(std::make_shared<AlignedAllocator>(4096));
+            reader.open(path);
+            TEST(reinterpret_cast<uintptr_t>(reader.getImage(1).imageData()) % 4096, "Image data are not aligned");
+            TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Images read with aligned allocator doesn't match");
+            reader.setAllocator(std::make_shared<HugePageAllocator>(1024));
+            reader.open(path);
+            TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Images read with huge page allocator doesn't match");
+            reader.close();
+
+            auto pool = std::make_shared<BufferPool>();
+            reader.setAllocator(pool);
+            size_t poolAllocations = 0;
+            for(int i = 0; i < 4; i++)
+            {
+                reader.open(path);
+                TEST(std::memcmp(image.imageData(), reader.getImage(1).imageData(), image.imageDataSize()), "Images read with buffer pool doesn't match");
+                if(i == 0)
+                    poolAllocations = pool->allocationCount();
+            }
+            reader.close();
+            TEST(pool->allocationCount() != poolAllocations, "Buffer pool doesn't recycle buffers");
+            reader.setAllocator(nullptr);
+
+            XISFWriter parallelWriter;
+            parallelWriter.setThreadCount(4);
+            for(int i = 0; i < 6; i++)
+                parallelWriter.writeImage(image);
+            parallelWriter.save(path);
+            reader.open(path);
+            TEST(reader.imagesCount() != 6, "Parallel save image count doesn't match");
+            for(int i = 0; i < 6; i++)
+                TEST(std::memcmp(image.imageData(), reader.getImage(i).imageData(), image.imageDataSize()), "Parallel save images doesn't match");
+            reader.close();
+            std::filesystem::remove(path);
+
+            {
+                Image tables(8, 8);
+                std::memset(tables.imageData(), 3, tables.imageDataSize());
+                F64Vector distortion(4096);
+                for(size_t i = 0; i < distortion.size(); i++)
+                    distortion[i] = i * 0.25;
+                F32Matrix matrix(40, 30);
+                for(int r = 0; r < matrix.rows(); r++)
+                    for(int c = 0; c < matrix.cols(); c++)
+                        matrix(r, c) = r - c * 0.5f;
+                ByteArray icc(5000);
+                for(size_t i = 0; i < icc.size(); i++)
+                    icc[i] = i % 251;
+                tables.addProperty(Property("Distortion", distortion));
+                tables.addProperty(Property("Small", F32Vector{1.0f, 2.0f}));
+                tables.addProperty(Property("Matrix", matrix));
+                tables.setIccProfile(icc);
+
+                XISFWriter tablesWriter;
+                tablesWriter.setAttachmentThreshold(1024, DataBlock::Zlib);
+                tablesWriter.writeImage(tables);
+                tablesWriter.writeImage(tables);
+                ByteArray tablesData;
+                tablesWriter.save(tablesData);
+                TEST(std::string_view(tablesData.constData(), tablesData.size()).find("inline:base64") == std::string_view::npos,
+                     "Small property wasn't written inline");
+                TEST(tablesData.size() > 16 * 1024, "Property attachments weren't compressed");
+
+                XISFWriter tablesParallelWriter;
+                tablesParallelWriter.setThreadCount(2);
+                tablesParallelWriter.setAttachmentThreshold(1024);
+                tablesParallelWriter.writeImage(tables);
+                tablesParallelWriter.writeImage(tables);
+                tablesParallelWriter.save(path);
+
+                for(int s = 0; s < 2; s++)
+                {
+                    if(s == 0)
+                        reader.open(tablesData);
+                    else
+                        reader.open(path);
+
+                    TEST(reader.imagesCount() != 2, "Property attachments image count doesn't match");
+                    for(int i = 0; i < 2; i++)
+                    {
+                        const Image &read = reader.getImage(i);
+                        TEST(std::memcmp(read.imageData(), tables.imageData(), tables.imageDataSize()), "Property attachments image data doesn't match");
+                        TEST(read.findProperty("Distortion")->value.value<F64Vector>() != distortion, "Vector property attachment doesn't match");
+                        TEST(read.findProperty("Small")->value.value<F32Vector>() != F32Vector({1.0f, 2.0f}), "Inline vector property doesn't match");
+                        F32Matrix readMatrix = read.findProperty("Matrix")->value.value<F32Matrix>();
+                        TEST(readMatrix.rows() != 40 || readMatrix.cols() != 30 || readMatrix(39, 29) != matrix(39, 29), "Matrix property attachment doesn't match");
+                        TEST(read.iccProfile().size() != icc.size() || std::memcmp(read.iccProfile().constData(), icc.constData(), icc.size()), "ICC profile attachment doesn't match");
+                    }
+                }
+                reader.close();
+                std::filesystem::remove(path);
+            }
+
+            {
+                // identical data blocks are written once, same data with different compression are not shared
+                Image bias(64, 64);
+                Image dark(64, 64);
+                std::memset(bias.imageData(), 1, bias.imageDataSize());
+                std::memset(dark.imageData(), 2, dark.imageDataSize());
+                Image compressedBias = bias;
+                compressedBias.setCompression(DataBlock::LZ4);
+                const Image *images[] = {&bias, &dark, &bias, &compressedBias, &bias, &compressedBias};
+
+                for(int threads = 1; threads <= 2; threads++)
+                {
+                    XISFWriter dedupWriter;
+                    dedupWriter.setThreadCount(threads);
+                    for(auto img : images)
+                        dedupWriter.writeImage(*img);
+                    dedupWriter.save(path);
+                    TEST(std::filesystem::file_size(path) > 3 * bias.imageDataSize(), "Identical data blocks were written more than once");
+
+                    reader.open(path);
+                    TEST(reader.imagesCount() != 6, "Deduplicated image count doesn't match");
+                    for(int i = 0; i < 6; i++)
+                    {
+                        const Image &read = reader.getImage(i);
+                        TEST(read.compression() != images[i]->compression(), "Deduplicated image compression doesn't match");
+                        TEST(std::memcmp(read.imageData(), images[i]->imageData(), bias.imageDataSize()), "Deduplicated image data doesn't match");
+                    }
+                    reader.close();
+
+                    XISFModify dedupModify;
+                    dedupModify.open(path);
+                    dedupModify.addFITSKeyword(0, {"NEWKEY", "1", ""});
+                    ByteArray modified;
+                    dedupModify.save(modified);
+                    dedupModify.close();
+                    TEST(modified.size() > 3 * bias.imageDataSize(), "Modify wrote shared attachment more than once");
+                    reader.open(modified);
+                    for(int i = 0; i < 6; i++)
+                        TEST(std::memcmp(reader.getImage(i).imageData(), images[i]->imageData(), bias.imageDataSize()), "Modified deduplicated image data doesn't match");
+                    reader.close();
+                }
+                std::filesystem::remove(path);
+            }
+
+            {
+                std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><xisf version=\"1.0\">"
+                                  "<Image geometry=\"2:2:1\" sampleFormat=\"UInt8\" colorSpace=\"Gray\" location=\"attachment:4096:4\">"
+                                  "<Property id=\"Vector\" type=\"F32Vector\" length=\"4\" location=\"attachment:4100:16\"/></Image></xisf>";
+                F32Vector vector = {1.5f, -2.0f, 3.25f, 1e6f};
+                ByteArray file(4116);
+                uint32_t headerSize = xml.size();
+                std::memcpy(file.data(), "XISF0100", 8);
+                std::memcpy(file.data() + 8, &headerSize, sizeof(headerSize));
+                std::memcpy(file.data() + 16, xml.c_str(), xml.size());
+                std::memcpy(file.data() + 4100, vector.data(), 16);
+
+                XISFReader lazyReader;
+                lazyReader.open(file);
+                Property lazyProperty = lazyReader.getImage(0).imageProperties().at(0);
+                TEST(lazyProperty.value.isLoaded(), "Property attachment was read during open");
+                TEST(lazyProperty.value.type() != Variant::Type::F32Vector, "Lazy property has wrong type");
+                lazyReader.close();
+                TEST(lazyProperty.value.value<F32Vector>() != vector, "Lazy property value doesn't match");
+
+                std::string lazyPath = (std::filesystem::temp_directory_path() / "libxisf_lazy.xisf").string();
+                std::ofstream(lazyPath, std::ios::binary).write(file.constData(), file.size());
+                lazyReader.open(lazyPath);
+                Property fileProperty = lazyReader.getImage(0).imageProperties().at(0);
+                lazyReader.close();
+                TEST(fileProperty.value.value<F32Vector>() != vector, "Lazy property read after close doesn't match");
+                lazyReader.open(lazyPath);
+                Property changedProperty = lazyReader.getImage(0).imageProperties().at(0);
+                lazyReader.close();
+                std::ofstream(lazyPath, std::ios::binary | std::ios::app).put(0);
+                bool changeDetected = false;
+                try { changedProperty.value.value<F32Vector>(); } catch(Error &) { changeDetected = true; }
+                TEST(!changeDetected, "Lazy property was read from changed file");
+                std::filesystem::remove(lazyPath);
+
+                SequentialBuffer lazyBuffer(file);
+                lazyReader.open(new std::istream(&lazyBuffer), false);
+                Property streamProperty = lazyReader.getImage(0).imageProperties().at(0);
+                TEST(streamProperty.value.value<F32Vector>() != vector, "Lazy property read from stream doesn't match");
+
+                std::atomic<int> loads = 0;
+                Variant shared = F32Vector();
+                shared.setLoader([&loads, &vector](){ loads++; return Variant(vector); });
+                const Variant &original = shared;
+                const Variant copy = shared;
+                std::vector<std::thread> threads;
+                std::atomic<int> mismatches = 0;
+                for(int i = 0; i < 8; i++)
+                    threads.emplace_back([&, i](){ if((i % 2 ? copy : original).value<F32Vector>() != vector) mismatches++; });
+                for(auto &thread : threads)
+                    thread.join();
+                TEST(loads != 1 || mismatches || !shared.isLoaded(), "Lazy value wasn't loaded exactly once");
+                shared.value<F32Vector>().push_back(0);
+                TEST(copy.value<F32Vector>() != vector, "Modified lazy value changed its copy");
+            }
+
+            {
+                std::string xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?><!-- comment <Image/> -->\r\n<xisf version='1.0'>"
+                                  "<Property id=\"Root\" type=\"Int32\" value=\"42\"/>"
+                                  "<Image geometry=\"2:2:1\" sampleFormat=\"UInt8\" colorSpace=\"Gray\" location=\"embedded\">"
+                                  "<Property id=\"Text\" type=\"String\"><![CDATA[a<b]]></Property>"
+                                  "<Property id=\"Time\" type=\"TimePoint\" value=\"2024-03-01T01:10:05.25+01:30\"/>"
+                                  "<Property id=\"Complex\" type=\"Complex64\" value=\"( 1.5, -2.5)\"/>"
+                                  "<FITSKeyword name=\"OBJECT\" value=\"&apos;M&#x34;2 &lt;&amp;&gt;&apos;\" comment=\"line\nbreak\"/>"
+                                  "<Data encoding=\"base64\">\nAQID\nBA==\n</Data>"
+                                  "<Thumbnail geometry=\"1:1:1\" sampleFormat=\"UInt8\" colorSpace=\"Gray\" location=\"inline:base16\">7f</Thumbnail>"
+                                  "</Image></xisf>";
+                ByteArray file(16 + xml.size());
+                uint32_t headerSize = xml.size();
+                std::memcpy(file.data(), "XISF0100", 8);
+                std::memcpy(file.data() + 8, &headerSize, sizeof(headerSize));
+                std::memcpy(file.data() + 16, xml.c_str(), xml.size());
+
+                XISFReader xmlReader;
+                xmlReader.open(file);
+                const Image &xmlImage = xmlReader.getImage(0);
+                TEST(std::memcmp(xmlImage.imageData(), "\x01\x02\x03\x04", 4), "Embedded image data doesn't match");
+                TEST(xmlImage.imageProperties().at(0).value.value<String>() != "a<b", "CDATA property doesn't match");
+                TEST(xmlImage.fitsKeywords().at(0).value != "'M42 <&>'", "Escaped FITS keyword value doesn't match");
+                TEST(xmlImage.fitsKeywords().at(0).comment != "line break", "Attribute whitespace wasn't normalized");
+                const std::tm &time = xmlImage.findProperty("Time")->value.value<TimePoint>();
+                TEST(time.tm_year != 124 || time.tm_mon != 1 || time.tm_mday != 29 || time.tm_hour != 23 || time.tm_min != 40 || time.tm_sec != 5 || time.tm_wday != 4,
+                     "TimePoint with offset doesn't match");
+                const Complex64 &complex = xmlImage.findProperty("Complex")->value.value<Complex64>();
+                TEST(complex.real != 1.5 || complex.imag != -2.5, "Complex property doesn't match");
+                TEST(std::strcmp(Variant(C64Matrix()).typeName(), "C64Matrix"), "Type name doesn't match");
+                TEST(xmlReader.getThumbnail().width() != 1 || *(uint8_t*)xmlReader.getThumbnail().imageData() != 0x7f, "Image thumbnail doesn't match");
+            }
+
             XISFModify mod;
             mod.open(data);
             mod.addFITSKeyword(0, {"NEWKEY", "1.0", ""});
@@ -94,10 +608,71 @@ int main(int argc, char **argv)
             TEST(fitsKeywords[1].name != "DEC", "Incorrect FITS DEC keyword");
             TEST(fitsKeywords[2].name != "NEWKEY", "Incorrect FITS NEWKEY keyword");
             TEST(fitsKeywords[3].name != "OBJECT", "Incorrect FITS OBJECT keyword");
-        }
-        else if(argc == 2 && std::strcmp(argv[1], "bench") == 0)
-        {
-            benchmark();
+
+            {
+                // header sizes around 10000 bytes where attachment positions get one more digit
+                Image small(4, 4);
+                std::memset(small.imageData(), 7, small.imageDataSize());
+                XISFWriter baseWriter;
+                baseWriter.writeImage(small);
+                baseWriter.writeImage(small);
+                ByteArray base;
+                baseWriter.save(base);
+                int length = 10000 - (int)base.size();
+                for(int i = length - 80; i < length + 80; i++)
+                {
+                    Image padded = small;
+                    padded.addFITSKeyword({"PADDING", "1", std::string(i, 'x')});
+                    XISFWriter paddedWriter;
+                    paddedWriter.writeImage(padded);
+                    paddedWriter.writeImage(padded);
+                    ByteArray paddedData;
+                    paddedWriter.save(paddedData);
+                    reader.open(paddedData);
+                    TEST(std::memcmp(reader.getImage(1).imageData(), small.imageData(), small.imageDataSize()), "Attachment position near digit boundary doesn't match");
+
+                    mod.open(paddedData);
+                    mod.save(data2);
+                    reader.open(data2);
+                    TEST(std::memcmp(reader.getImage(1).imageData(), small.imageData(), small.imageDataSize()), "Modified attachment position near digit boundary doesn't match");
+                }
+                reader.close();
+            }
+
+            {
+                Image frame(8, 4);
+                frame.addFITSKeyword({"CCD-TEMP", "-10.0", "Sensor temperature"});
+                frame.addFITSKeyword({"DATE-OBS", "'2024-01-01T00:00:00'", "Exposure start"});
+                frame.addFITSKeyword({"OBJECT", "'M31'", ""});
+                frame.addProperty(Property("Instrument:ExposureTime", 1.0));
+                HeaderTemplate headerTemplate(frame, {"CCD-TEMP", "DATE-OBS", "Instrument:ExposureTime"});
+                headerTemplate.setFITSKeyword("CCD-TEMP", "-9.5");
+                headerTemplate.setFITSKeyword("DATE-OBS", "'2024-01-01T00:01:00'");
+                headerTemplate.setProperty("Instrument:ExposureTime", 120.5);
+
+                std::vector<uint16_t> pixels(8 * 4);
+                for(size_t i = 0; i < pixels.size(); i++)
+                    pixels[i] = i * 1000;
+                ByteArray frameData;
+                headerTemplate.save(frameData, pixels.data());
+                reader.open(frameData);
+                const Image &frameImage = reader.getImage(0);
+                TEST(frameImage.findFITSKeyword("CCD-TEMP")->value != "-9.5", "Template FITS keyword doesn't match");
+                TEST(frameImage.findFITSKeyword("DATE-OBS")->value != "'2024-01-01T00:01:00'", "Template FITS keyword doesn't match");
+                TEST(frameImage.findFITSKeyword("OBJECT")->value != "'M31'", "Constant template FITS keyword doesn't match");
+                TEST(frameImage.findProperty("Instrument:ExposureTime")->value.value<double>() != 120.5, "Template property doesn't match");
+                TEST(std::memcmp(frameImage.imageData(), pixels.data(), frameImage.imageDataSize()), "Template image data doesn't match");
+                reader.close();
+
+                bool thrown = false;
+                try { headerTemplate.setFITSKeyword("CCD-TEMP", std::string(40, '1')); }
+                catch(const Error &) { thrown = true; }
+                TEST(!thrown, "Template value overflow wasn't detected");
+                thrown = false;
+                try { headerTemplate.setFITSKeyword("OBJECT", "'M33'"); }
+                catch(const Error &) { thrown = true; }
+                TEST(!thrown, "Constant template FITS keyword was changed");
+            }
         }
         else
         {
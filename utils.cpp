@@ -16,9 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
  ************************************************************************/
 
+#include "libxisf.h"
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 namespace LibXISF
 {
@@ -38,6 +45,85 @@ std::vector<std::string> splitString(const std::string &str, char delimiter)
     return ret;
 }
 
+/** Remove padding and quotes from FITS string values */
+std::string normalizeKeywordValue(std::string_view value)
+{
+    size_t begin = value.find_first_not_of(' ');
+    size_t end = value.find_last_not_of(' ');
+    if(begin == std::string_view::npos)
+        return std::string();
+
+    value = value.substr(begin, end - begin + 1);
+    if(value.size() >= 2 && value.front() == '\'' && value.back() == '\'')
+    {
+        value = value.substr(1, value.size() - 2);
+        size_t last = value.find_last_not_of(' ');
+        value = value.substr(0, last == std::string_view::npos ? 0 : last + 1);
+    }
+    return std::string(value);
+}
+
+/** std::stoull that throws Error instead of std::invalid_argument and std::out_of_range */
+uint64_t parseUInt64(const std::string &str, size_t *pos)
+{
+    try
+    {
+        return std::stoull(str, pos);
+    }
+    catch(std::logic_error &)
+    {
+        throw Error("Invalid number \"" + str + "\"");
+    }
+}
+
+/** std::stod that throws Error instead of std::invalid_argument and std::out_of_range */
+double parseDouble(const std::string &str)
+{
+    try
+    {
+        return std::stod(str);
+    }
+    catch(std::logic_error &)
+    {
+        throw Error("Invalid number \"" + str + "\"");
+    }
+}
+
+/** Run func(i) for i in [0, count) on multiple threads. First exception is rethrown in calling thread */
+void runParallel(int threads, size_t count, const std::function<void(size_t)> &func)
+{
+    std::atomic<size_t> next(0);
+    std::exception_ptr exception;
+    std::mutex mutex;
+    auto worker = [&]()
+    {
+        size_t i;
+        while((i = next++) < count)
+        {
+            try
+            {
+                func(i);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!exception)
+                    exception = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(int i = 1; i < threads && (size_t)i < count; i++)
+        pool.emplace_back(worker);
+    worker();
+    for(auto &thread : pool)
+        thread.join();
+
+    if(exception)
+        std::rethrow_exception(exception);
+}
+
 void sha1(uint8_t *data, size_t len, uint8_t *hash)
 {
     uint32_t h0 = 0x67452301;
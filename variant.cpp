@@ -18,104 +18,75 @@
 
 #include <charconv>
 #include <type_traits>
-#include <map>
-#include <regex>
-#include <iomanip>
-#include <sstream>
+#include <string_view>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "libxisf.h"
-#include <pugixml.hpp>
+#include "xmlreader.h"
+#include "xmlwriter.h"
 
 namespace LibXISF
 {
 
-static std::map<std::string, Variant::Type> typeToId = {
-    {"Monostate",     Variant::Type::Monostate},
-    {"Boolean",       Variant::Type::Boolean},
-    {"Int8",          Variant::Type::Int8},
-    {"UInt8",         Variant::Type::UInt8},
-    {"Int16",         Variant::Type::Int16},
-    {"UInt16",        Variant::Type::UInt16},
-    {"Int32",         Variant::Type::Int32},
-    {"UInt32",        Variant::Type::UInt32},
-    {"Int64",         Variant::Type::Int64},
-    {"UInt64",        Variant::Type::UInt64},
-    {"Float32",       Variant::Type::Float32},
-    {"Float64",       Variant::Type::Float64},
-    {"Complex32",     Variant::Type::Complex32},
-    {"Complex64",     Variant::Type::Complex64},
-    {"String",        Variant::Type::String},
-    {"TimePoint",     Variant::Type::TimePoint},
-    {"I8Vector",      Variant::Type::I8Vector},
-    {"UI8Vector",     Variant::Type::UI8Vector},
-    {"I16Vector",     Variant::Type::I16Vector},
-    {"UI16Vector",    Variant::Type::UI16Vector},
-    {"I32Vector",     Variant::Type::I32Vector},
-    {"UI32Vector",    Variant::Type::UI32Vector},
-    {"I64Vector",     Variant::Type::I64Vector},
-    {"UI64Vector",    Variant::Type::UI64Vector},
-    {"F32Vector",     Variant::Type::F32Vector},
-    {"F64Vector",     Variant::Type::F64Vector},
-    {"C32Vector",     Variant::Type::C32Vector},
-    {"C64Vector",     Variant::Type::C64Vector},
-    {"I8Matrix",      Variant::Type::I8Matrix},
-    {"UI8Matrix",     Variant::Type::UI8Matrix},
-    {"I16Matrix",     Variant::Type::I16Matrix},
-    {"UI16Matrix",    Variant::Type::UI16Matrix},
-    {"I32Matrix",     Variant::Type::I32Matrix},
-    {"UI32Matrix",    Variant::Type::UI32Matrix},
-    {"I64Matrix",     Variant::Type::I64Matrix},
-    {"UI64Matrix",    Variant::Type::UI64Matrix},
-    {"F32Matrix",     Variant::Type::F32Matrix},
-    {"F64Matrix",     Variant::Type::F64Matrix},
-    {"C32Matrix",     Variant::Type::C32Matrix},
-    {"C64Matrix",     Variant::Type::C64Matrix},
+/** Type names in order of Variant::Type */
+static constexpr std::string_view typeNames[] = {
+    "Monostate", "Boolean", "Int8", "UInt8", "Int16", "UInt16", "Int32", "UInt32", "Int64", "UInt64", "Float32", "Float64",
+    "Complex32", "Complex64", "String", "TimePoint",
+    "I8Vector", "UI8Vector", "I16Vector", "UI16Vector", "I32Vector", "UI32Vector", "I64Vector", "UI64Vector",
+    "F32Vector", "F64Vector", "C32Vector", "C64Vector",
+    "I8Matrix", "UI8Matrix", "I16Matrix", "UI16Matrix", "I32Matrix", "UI32Matrix", "I64Matrix", "UI64Matrix",
+    "F32Matrix", "F64Matrix", "C32Matrix", "C64Matrix",
 };
+static constexpr size_t typeCount = sizeof(typeNames) / sizeof(typeNames[0]);
 
-static std::map<Variant::Type, const char*> idToType = {
-    {Variant::Type::Monostate,     "Monostate"},
-    {Variant::Type::Boolean,       "Boolean"},
-    {Variant::Type::Int8,          "Int8"},
-    {Variant::Type::UInt8,         "UInt8"},
-    {Variant::Type::Int16,         "Int16"},
-    {Variant::Type::UInt16,        "UInt16"},
-    {Variant::Type::Int32,         "Int32"},
-    {Variant::Type::UInt32,        "UInt32"},
-    {Variant::Type::Int64,         "Int64"},
-    {Variant::Type::UInt64,        "UInt64"},
-    {Variant::Type::Float32,       "Float32"},
-    {Variant::Type::Float64,       "Float64"},
-    {Variant::Type::Complex32,     "Complex32"},
-    {Variant::Type::Complex64,     "Complex64"},
-    {Variant::Type::String,        "String"},
-    {Variant::Type::TimePoint,     "TimePoint"},
-    {Variant::Type::I8Vector,      "I8Vector"},
-    {Variant::Type::UI8Vector,     "UI8Vector"},
-    {Variant::Type::I16Vector,     "I16Vector"},
-    {Variant::Type::UI16Vector,    "UI16Vector"},
-    {Variant::Type::I32Vector,     "I32Vector"},
-    {Variant::Type::UI32Vector,    "UI32Vector"},
-    {Variant::Type::I64Vector,     "I64Vector"},
-    {Variant::Type::UI64Vector,    "UI64Vector"},
-    {Variant::Type::F32Vector,     "F32Vector"},
-    {Variant::Type::F64Vector,     "F64Vector"},
-    {Variant::Type::C32Vector,     "C32Vector"},
-    {Variant::Type::C64Vector,     "C64Vector"},
-    {Variant::Type::I8Matrix,      "I8Matrix"},
-    {Variant::Type::UI8Matrix,     "UI8Matrix"},
-    {Variant::Type::I16Matrix,     "I16Matrix"},
-    {Variant::Type::UI16Matrix,    "UI16Matrix"},
-    {Variant::Type::I32Matrix,     "I32Matrix"},
-    {Variant::Type::UI32Matrix,    "UI32Matrix"},
-    {Variant::Type::I64Matrix,     "I64Matrix"},
-    {Variant::Type::UI64Matrix,    "UI64Matrix"},
-    {Variant::Type::F32Matrix,     "F32Matrix"},
-    {Variant::Type::F64Matrix,     "F64Matrix"},
+/** Hash without collisions for all names in typeNames. Name must have at least three characters */
+static constexpr size_t typeNameHash(std::string_view name)
+{
+    return (name[0] * 2 + name[1] * 7 + name[2] * 3 + name[name.size() - 2] * 29 + name.size()) & 63;
+}
+
+struct TypeTable
+{
+    uint8_t slots[64] = {};
 };
 
+static constexpr TypeTable makeTypeTable()
+{
+    TypeTable table;
+    for(size_t i = 0; i < typeCount; i++)
+        table.slots[typeNameHash(typeNames[i])] = i + 1;
+    return table;
+}
+
+static constexpr TypeTable typeTable = makeTypeTable();
+
+static constexpr bool typeTableIsPerfect()
+{
+    size_t used = 0;
+    for(uint8_t slot : typeTable.slots)
+        used += slot != 0;
+    return used == typeCount;
+}
+
+static_assert(typeTableIsPerfect(), "typeNameHash has collisions");
+
+/** Skip surrounding whitespace and leading plus sign which from_chars doesn't accept */
+static void trimNumber(const char *&beg, const char *&end)
+{
+    while(beg < end && (*beg == ' ' || *beg == '\t' || *beg == '\n' || *beg == '\r'))
+        beg++;
+    while(end > beg && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+    if(beg < end && *beg == '+')
+        beg++;
+}
+
 template<typename T>
 T fromChars(const char *beg, const char *end)
 {
-    T val;
+    T val{};
+    trimNumber(beg, end);
     std::from_chars(beg, end, val);
     return val;
 }
@@ -124,59 +95,284 @@ template<typename T>
 T fromCharsComplex(const char *beg, const char *end)
 {
     T val = {0, 0};
-    std::cmatch match;
-    std::regex regex("\\(([^,]+),([^)]+)\\)");
-    if(std::regex_match(beg, end, match, regex))
+    trimNumber(beg, end);
+    if(beg == end || *beg != '(' || end[-1] != ')')
+        return val;
+
+    const char *comma = std::find(beg, end, ',');
+    if(comma == end)
+        return val;
+
+    val.real = fromChars<decltype(val.real)>(beg + 1, comma);
+    val.imag = fromChars<decltype(val.imag)>(comma + 1, end - 1);
+    return val;
+}
+
+/** Parse exactly count decimal digits */
+static bool parseDigits(const char *&ptr, const char *end, int count, int &value)
+{
+    if(end - ptr < count)
+        return false;
+
+    value = 0;
+    for(int i = 0; i < count; i++, ptr++)
     {
-        val.real = std::stod(std::string(match[1].first, match[1].second));
-        val.imag = std::stod(std::string(match[1].first, match[1].second));
+        if(*ptr < '0' || *ptr > '9')
+            return false;
+        value = value * 10 + (*ptr - '0');
     }
-    return val;
+    return true;
+}
+
+/** Days since 1970-01-01 of proleptic Gregorian date */
+static int64_t daysFromCivil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(int64_t z, int64_t &y, int &m, int &d)
+{
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+}
+
+/** Parse ISO 8601 date and time YYYY-MM-DD[Thh:mm[:ss[.fraction]]][Z|+hh[:mm]|-hh[:mm]].
+ *  Time with offset is converted to UTC. std::tm can't hold fraction of second so it is dropped. */
+static bool parseTimePoint(std::string_view str, std::tm &tm)
+{
+    const char *ptr = str.data();
+    const char *end = ptr + str.size();
+    trimNumber(ptr, end);
+
+    int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0, offset = 0;
+    if(!parseDigits(ptr, end, 4, year) || ptr == end || *ptr++ != '-' ||
+       !parseDigits(ptr, end, 2, month) || ptr == end || *ptr++ != '-' ||
+       !parseDigits(ptr, end, 2, day))
+        return false;
+
+    if(ptr < end && (*ptr == 'T' || *ptr == ' '))
+    {
+        ptr++;
+        if(!parseDigits(ptr, end, 2, hour) || ptr == end || *ptr++ != ':' || !parseDigits(ptr, end, 2, minute))
+            return false;
+        if(ptr < end && *ptr == ':')
+        {
+            ptr++;
+            if(!parseDigits(ptr, end, 2, second))
+                return false;
+            if(ptr < end && (*ptr == '.' || *ptr == ','))
+            {
+                ptr++;
+                const char *digits = ptr;
+                while(ptr < end && *ptr >= '0' && *ptr <= '9')
+                    ptr++;
+                if(ptr == digits)
+                    return false;
+            }
+        }
+    }
+
+    if(ptr < end && *ptr == 'Z')
+    {
+        ptr++;
+    }
+    else if(ptr < end && (*ptr == '+' || *ptr == '-'))
+    {
+        int sign = *ptr++ == '-' ? -1 : 1;
+        int offsetHour = 0, offsetMinute = 0;
+        if(!parseDigits(ptr, end, 2, offsetHour))
+            return false;
+        if(ptr < end && *ptr == ':')
+            ptr++;
+        if(ptr < end && !parseDigits(ptr, end, 2, offsetMinute))
+            return false;
+        offset = sign * (offsetHour * 60 + offsetMinute);
+    }
+
+    if(ptr != end || month < 1 || month > 12 || day < 1 || day > 31 || hour > 24 || minute > 59 || second > 60)
+        return false;
+
+    int64_t days = daysFromCivil(year, month, day);
+    int64_t minutes = days * 1440 + hour * 60 + minute - offset;
+    days = minutes >= 0 ? minutes / 1440 : (minutes - 1439) / 1440;
+    minutes -= days * 1440;
+
+    int64_t y = 0;
+    civilFromDays(days, y, month, day);
+    tm = {};
+    tm.tm_year = y - 1900;
+    tm.tm_mon = month - 1;
+    tm.tm_mday = day;
+    tm.tm_hour = minutes / 60;
+    tm.tm_min = minutes % 60;
+    tm.tm_sec = second;
+    tm.tm_wday = (days % 7 + 11) % 7;
+    tm.tm_yday = days - daysFromCivil(y, 1, 1);
+    return true;
 }
 
 template<typename T>
 void fromCharsVector(Variant &v, size_t len, const ByteArray &data)
 {
-    v = T();
-    v.value<T>().resize(len);
     size_t size = len * sizeof(typename T::value_type);
-    std::memcpy(&v.value<T>()[0], data.data(), size);
+    if(data.size() < size)
+        throw Error("Property data are shorter than its length");
+
+    T vec(len);
+    if(size)
+        std::memcpy(vec.data(), data.constData(), size);
+    v.setValue(std::move(vec));
 }
 
 template<typename T>
 void fromCharsMatrix(Variant &v, size_t rows, size_t cols, const ByteArray &data)
 {
-    v = T(rows, cols);
     size_t size = rows * cols * sizeof(typename T::value_type);
-    std::memcpy(&v.value<T>()(0, 0), data.data(), size);
+    if(data.size() < size)
+        throw Error("Property data are shorter than its dimensions");
+
+    T matrix(rows, cols);
+    if(size)
+        std::memcpy(&matrix(0, 0), data.constData(), size);
+    v.setValue(std::move(matrix));
 }
 
+/** Big enough for any scalar value formatted by formatScalar() */
+static constexpr size_t scalarBufferSize = 64;
+
+/** Format number with to_chars. Floats use shortest representation that round trips */
 template<typename T>
-void toChars(const Variant &v, char *beg, char *end)
+static char* formatNumber(char *ptr, char *end, T value)
+{
+    if constexpr(std::is_same_v<T, Complex32> || std::is_same_v<T, Complex64>)
+    {
+        *ptr++ = '(';
+        ptr = std::to_chars(ptr, end, value.real).ptr;
+        *ptr++ = ',';
+        ptr = std::to_chars(ptr, end, value.imag).ptr;
+        *ptr++ = ')';
+        return ptr;
+    }
+    else
+    {
+        return std::to_chars(ptr, end, value).ptr;
+    }
+}
+
+static char* formatDigits(char *ptr, int value, int count)
 {
-    std::to_chars(beg, end, v.value<T>());
+    for(int i = count - 1; i >= 0; i--, value /= 10)
+        ptr[i] = '0' + value % 10;
+    return ptr + count;
 }
 
+/** Format as YYYY-MM-DDThh:mm:ssZ */
+static char* formatTimePoint(char *ptr, char *end, const std::tm &tm)
+{
+    int year = tm.tm_year + 1900;
+    ptr = year >= 0 && year <= 9999 ? formatDigits(ptr, year, 4) : std::to_chars(ptr, end, year).ptr;
+    *ptr++ = '-';
+    ptr = formatDigits(ptr, tm.tm_mon + 1, 2);
+    *ptr++ = '-';
+    ptr = formatDigits(ptr, tm.tm_mday, 2);
+    *ptr++ = 'T';
+    ptr = formatDigits(ptr, tm.tm_hour, 2);
+    *ptr++ = ':';
+    ptr = formatDigits(ptr, tm.tm_min, 2);
+    *ptr++ = ':';
+    ptr = formatDigits(ptr, tm.tm_sec, 2);
+    *ptr++ = 'Z';
+    return ptr;
+}
+
+/** Write value of scalar variant into buffer of scalarBufferSize bytes. Return end of text or nullptr when variant is not scalar */
+char* formatScalar(const Variant &variant, char *ptr, char *end)
+{
+    switch(variant.type())
+    {
+    case Variant::Type::Boolean: *ptr++ = variant.value<Boolean>() ? '1' : '0'; return ptr;
+    case Variant::Type::Int8: return formatNumber(ptr, end, variant.value<Int8>());
+    case Variant::Type::UInt8: return formatNumber(ptr, end, variant.value<UInt8>());
+    case Variant::Type::Int16: return formatNumber(ptr, end, variant.value<Int16>());
+    case Variant::Type::UInt16: return formatNumber(ptr, end, variant.value<UInt16>());
+    case Variant::Type::Int32: return formatNumber(ptr, end, variant.value<Int32>());
+    case Variant::Type::UInt32: return formatNumber(ptr, end, variant.value<UInt32>());
+    case Variant::Type::Int64: return formatNumber(ptr, end, variant.value<Int64>());
+    case Variant::Type::UInt64: return formatNumber(ptr, end, variant.value<UInt64>());
+    case Variant::Type::Float32: return formatNumber(ptr, end, variant.value<Float32>());
+    case Variant::Type::Float64: return formatNumber(ptr, end, variant.value<Float64>());
+    case Variant::Type::Complex32: return formatNumber(ptr, end, variant.value<Complex32>());
+    case Variant::Type::Complex64: return formatNumber(ptr, end, variant.value<Complex64>());
+    case Variant::Type::TimePoint: return formatTimePoint(ptr, end, variant.value<TimePoint>());
+    default: return nullptr;
+    }
+}
+
+/** Append comma separated elements */
 template<typename T>
-void toCharsComplex(const Variant &v, std::string &str)
+static void appendElements(std::string &out, const T *data, size_t count)
 {
-    T complex = v.value<T>();
-    std::stringstream ss;
-    ss.imbue(std::locale("C"));
-    ss << "(" << complex.real << "," << complex.imag << ")";
-    str = ss.str();
+    char str[scalarBufferSize];
+    for(size_t i = 0; i < count; i++)
+    {
+        if(i)
+            out += ',';
+        out.append(str, formatNumber(str, str + sizeof(str), data[i]));
+    }
 }
 
+template<typename T>
+static void appendString(std::string &out, const std::vector<T> &vector)
+{
+    out.reserve(vector.size() * 8 + 2);
+    out += '{';
+    appendElements(out, vector.data(), vector.size());
+    out += '}';
+}
+
+template<typename T>
+static void appendString(std::string &out, const Matrix<T> &matrix)
+{
+    out.reserve(matrix.rows() * (matrix.cols() * 8 + 3) + 2);
+    out += '{';
+    for(int i = 0; i < matrix.rows(); i++)
+    {
+        if(i)
+            out += ',';
+        out += '{';
+        if(matrix.cols())
+            appendElements(out, &matrix(i, 0), matrix.cols());
+        out += '}';
+    }
+    out += '}';
+}
+
+/** Scalars are handled by formatScalar() */
+template<typename T>
+static void appendString(std::string &, const T &)
+{
+}
 
 template<typename T>
 void toCharsVector(const Variant &v, size_t &len, ByteArray &data)
 {
     len = v.value<T>().size();
     size_t size = len * sizeof(typename T::value_type);
-    data.resize(size);
-    std::memcpy(data.data(), &v.value<T>()[0], size);
-    data.encodeBase64();
-    data.append('\0');
+    data.resizeUninitialized(size);
+    if(size)
+        std::memcpy(data.data(), &v.value<T>()[0], size);
 }
 
 template<typename T>
@@ -185,214 +381,235 @@ void toCharsMatrix(const Variant &v, size_t &rows, size_t &cols, ByteArray &data
     rows = v.value<T>().rows();
     cols = v.value<T>().cols();
     size_t size = rows * cols * sizeof(typename T::value_type);
-    data.resize(size);
-    std::memcpy(data.data(), &v.value<T>()(0, 0), size);
-    data.encodeBase64();
-    data.append('\0');
+    data.resizeUninitialized(size);
+    if(size)
+        std::memcpy(data.data(), &v.value<T>()(0, 0), size);
 }
 
-void deserializeVariant(const pugi::xml_node &node, Variant &variant, const ByteArray &data)
+/** Fill String, vector or matrix variant from content of its data block. For vectors rows is length and cols is ignored */
+static void variantFromData(Variant &variant, Variant::Type typeId, size_t rows, size_t cols, const ByteArray &data)
 {
-    std::string type = node.attribute("type").as_string();
-    Variant::Type typeId = typeToId[type];
-
-    if(typeId == Variant::Type::String)
+    switch(typeId)
     {
-        if(!node.attribute("location"))
-            variant.setValue(node.text().as_string());
-        else
-            variant.setValue(String(data.constData(), data.size()));
+    case Variant::Type::String: variant.setValue(data.size() ? String(data.constData(), data.size()) : String()); break;
+    case Variant::Type::I8Vector: fromCharsVector<I8Vector>(variant, rows, data); break;
+    case Variant::Type::UI8Vector: fromCharsVector<UI8Vector>(variant, rows, data); break;
+    case Variant::Type::I16Vector: fromCharsVector<I16Vector>(variant, rows, data); break;
+    case Variant::Type::UI16Vector: fromCharsVector<UI16Vector>(variant, rows, data); break;
+    case Variant::Type::I32Vector: fromCharsVector<I32Vector>(variant, rows, data); break;
+    case Variant::Type::UI32Vector: fromCharsVector<UI32Vector>(variant, rows, data); break;
+    case Variant::Type::I64Vector: fromCharsVector<I64Vector>(variant, rows, data); break;
+    case Variant::Type::UI64Vector: fromCharsVector<UI64Vector>(variant, rows, data); break;
+    case Variant::Type::F32Vector: fromCharsVector<F32Vector>(variant, rows, data); break;
+    case Variant::Type::F64Vector: fromCharsVector<F64Vector>(variant, rows, data); break;
+    case Variant::Type::C32Vector: fromCharsVector<C32Vector>(variant, rows, data); break;
+    case Variant::Type::C64Vector: fromCharsVector<C64Vector>(variant, rows, data); break;
+    case Variant::Type::I8Matrix: fromCharsMatrix<I8Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::UI8Matrix: fromCharsMatrix<UI8Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::I16Matrix: fromCharsMatrix<I16Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::UI16Matrix: fromCharsMatrix<UI16Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::I32Matrix: fromCharsMatrix<I32Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::UI32Matrix: fromCharsMatrix<UI32Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::I64Matrix: fromCharsMatrix<I64Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::UI64Matrix: fromCharsMatrix<UI64Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::F32Matrix: fromCharsMatrix<F32Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::F64Matrix: fromCharsMatrix<F64Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::C32Matrix: fromCharsMatrix<C32Matrix>(variant, rows, cols, data); break;
+    case Variant::Type::C64Matrix: fromCharsMatrix<C64Matrix>(variant, rows, cols, data); break;
+    default: break;
     }
-    else if(node.attribute("value"))
+}
+
+Variant::Type variantType(std::string_view name)
+{
+    if(name.size() < 3)
+        return Variant::Type::Monostate;
+
+    uint8_t slot = typeTable.slots[typeNameHash(name)];
+    return slot && typeNames[slot - 1] == name ? (Variant::Type)(slot - 1) : Variant::Type::Monostate;
+}
+
+/** Return dimensions of vector or matrix property read from attributes of current Property element */
+std::pair<size_t, size_t> variantDimensions(const XmlReader &xml, Variant::Type typeId)
+{
+    auto attribute = [&xml](const char *name)
     {
-        auto attr = node.attribute("value").value();
-        switch(typeId)
-        {
-        case Variant::Type::Int8: variant.setValue(fromChars<Int8>(attr, attr + strlen(attr))); break;
-        case Variant::Type::UInt8: variant.setValue(fromChars<UInt8>(attr, attr + strlen(attr))); break;
-        case Variant::Type::Int16: variant.setValue(fromChars<Int16>(attr, attr + strlen(attr))); break;
-        case Variant::Type::UInt16: variant.setValue(fromChars<UInt16>(attr, attr + strlen(attr))); break;
-        case Variant::Type::Int32: variant.setValue(fromChars<Int32>(attr, attr + strlen(attr))); break;
-        case Variant::Type::UInt32: variant.setValue(fromChars<UInt32>(attr, attr + strlen(attr))); break;
-        case Variant::Type::Int64: variant.setValue(fromChars<Int64>(attr, attr + strlen(attr))); break;
-        case Variant::Type::UInt64: variant.setValue(fromChars<UInt64>(attr, attr + strlen(attr))); break;
-        case Variant::Type::Float32: variant.setValue(node.attribute("value").as_float()); break;
-        case Variant::Type::Float64: variant.setValue(node.attribute("value").as_double()); break;
-        case Variant::Type::Complex32: variant.setValue(fromCharsComplex<Complex32>(attr, attr + strlen(attr))); break;
-        case Variant::Type::Complex64: variant.setValue(fromCharsComplex<Complex64>(attr, attr + strlen(attr))); break;
-        case Variant::Type::TimePoint:
-        {
-            std::istringstream ss(node.attribute("value").value());
-            std::tm tm = {};
-            ss >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
-            variant = tm;
-            break;
-        }
-        case Variant::Type::Boolean:
-            variant = node.attribute("value").as_bool();
-            break;
-        default: break;
-        }
-    }
-    else if(typeId >= Variant::Type::I8Vector && typeId <= Variant::Type::C64Vector)
+        std::string_view value = xml.attribute(name);
+        return fromChars<uint64_t>(value.data(), value.data() + value.size());
+    };
+
+    if(typeId >= Variant::Type::I8Vector && typeId <= Variant::Type::C64Vector)
+        return {attribute("length"), 1};
+    if(typeId >= Variant::Type::I8Matrix && typeId <= Variant::Type::C64Matrix)
+        return {attribute("rows"), attribute("columns")};
+    return {0, 0};
+}
+
+/** Set scalar variant from content of value attribute */
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::string_view value)
+{
+    const char *beg = value.data();
+    const char *end = beg + value.size();
+    switch(typeId)
     {
-        size_t len = node.attribute("length").as_ullong();
-        switch(typeId)
-        {
-        case Variant::Type::I8Vector: fromCharsVector<I8Vector>(variant, len, data); break;
-        case Variant::Type::UI8Vector: fromCharsVector<UI8Vector>(variant, len, data); break;
-        case Variant::Type::I16Vector: fromCharsVector<I16Vector>(variant, len, data); break;
-        case Variant::Type::UI16Vector: fromCharsVector<UI16Vector>(variant, len, data); break;
-        case Variant::Type::I32Vector: fromCharsVector<I32Vector>(variant, len, data); break;
-        case Variant::Type::UI32Vector: fromCharsVector<UI32Vector>(variant, len, data); break;
-        case Variant::Type::I64Vector: fromCharsVector<I64Vector>(variant, len, data); break;
-        case Variant::Type::UI64Vector: fromCharsVector<UI64Vector>(variant, len, data); break;
-        case Variant::Type::F32Vector: fromCharsVector<F32Vector>(variant, len, data); break;
-        case Variant::Type::F64Vector: fromCharsVector<F64Vector>(variant, len, data); break;
-        case Variant::Type::C32Vector: fromCharsVector<C32Vector>(variant, len, data); break;
-        case Variant::Type::C64Vector: fromCharsVector<C64Vector>(variant, len, data); break;
-        default: break;
-        }
-    }
-    else if(typeId >= Variant::Type::I8Matrix && typeId <= Variant::Type::C64Matrix)
+    case Variant::Type::Int8: variant.setValue(fromChars<Int8>(beg, end)); break;
+    case Variant::Type::UInt8: variant.setValue(fromChars<UInt8>(beg, end)); break;
+    case Variant::Type::Int16: variant.setValue(fromChars<Int16>(beg, end)); break;
+    case Variant::Type::UInt16: variant.setValue(fromChars<UInt16>(beg, end)); break;
+    case Variant::Type::Int32: variant.setValue(fromChars<Int32>(beg, end)); break;
+    case Variant::Type::UInt32: variant.setValue(fromChars<UInt32>(beg, end)); break;
+    case Variant::Type::Int64: variant.setValue(fromChars<Int64>(beg, end)); break;
+    case Variant::Type::UInt64: variant.setValue(fromChars<UInt64>(beg, end)); break;
+    case Variant::Type::Float32: variant.setValue(fromChars<Float32>(beg, end)); break;
+    case Variant::Type::Float64: variant.setValue(fromChars<Float64>(beg, end)); break;
+    case Variant::Type::Complex32: variant.setValue(fromCharsComplex<Complex32>(beg, end)); break;
+    case Variant::Type::Complex64: variant.setValue(fromCharsComplex<Complex64>(beg, end)); break;
+    case Variant::Type::TimePoint:
     {
-        size_t rows = node.attribute("rows").as_ullong();
-        size_t cols = node.attribute("columns").as_ullong();
-        switch(typeId)
-        {
-        case Variant::Type::I8Matrix: fromCharsMatrix<I8Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI8Matrix: fromCharsMatrix<UI8Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I16Matrix: fromCharsMatrix<I16Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI16Matrix: fromCharsMatrix<UI16Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I32Matrix: fromCharsMatrix<I32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI32Matrix: fromCharsMatrix<UI32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I64Matrix: fromCharsMatrix<I64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI64Matrix: fromCharsMatrix<UI64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::F32Matrix: fromCharsMatrix<F32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::F64Matrix: fromCharsMatrix<F64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::C32Matrix: fromCharsMatrix<C32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::C64Matrix: fromCharsMatrix<C64Matrix>(variant, rows, cols, data); break;
-        default: break;
-        }
+        std::tm tm = {};
+        if(!parseTimePoint(value, tm))
+            tm = {};
+        variant = tm;
+        break;
+    }
+    case Variant::Type::Boolean:
+        variant = value.size() && std::strchr("1tTyY", value[0]);
+        break;
+    default: break;
     }
 }
 
-void serializeVariant(pugi::xml_node &node, const Variant &variant)
+/** Set String, vector or matrix variant from its data block */
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::pair<size_t, size_t> dim, const ByteArray &data)
 {
-    char str[32] = {0};
-    char *end = str + sizeof(str);
+    variantFromData(variant, typeId, dim.first, dim.second, data);
+}
 
-    node.append_attribute("type").set_value(variant.typeName());
+/** Same as above but data block is loaded only when value is accessed first time */
+void deserializeVariant(Variant &variant, Variant::Type typeId, std::pair<size_t, size_t> dim, const std::function<ByteArray()> &data)
+{
+    if(typeId != Variant::Type::String && (typeId < Variant::Type::I8Vector || typeId > Variant::Type::C64Matrix))
+        return;
 
-    if(variant.type() == Variant::Type::String)
-    {
-        node.append_child(pugi::node_pcdata).set_value(variant.value<String>().c_str());
-    }
-    else if(variant.type() == Variant::Type::Boolean)
+    // empty value of right type so type() works before value is loaded
+    variantFromData(variant, typeId, 0, 0, ByteArray());
+    variant.setLoader([typeId, dim, data]()
     {
-        node.append_attribute("value").set_value(variant.value<Boolean>() ? 1 : 0);
-    }
-    else if(variant.type() >= Variant::Type::Int8 && variant.type() <= Variant::Type::UInt64)
+        Variant variant;
+        variantFromData(variant, typeId, dim.first, dim.second, data());
+        return variant;
+    });
+}
+
+/** Raw content of vector or matrix variant. For vectors first dimension is length and second is zero.
+ *  Return false for other types */
+bool serializeVariant(const Variant &variant, std::pair<size_t, size_t> &dim, ByteArray &data)
+{
+    dim = {0, 0};
+    if(variant.type() >= Variant::Type::I8Vector && variant.type() <= Variant::Type::C64Vector)
     {
         switch(variant.type())
         {
-        case Variant::Type::Int8: toChars<Int8>(variant, str, end); break;
-        case Variant::Type::UInt8: toChars<UInt8>(variant, str, end); break;
-        case Variant::Type::Int16: toChars<Int16>(variant, str, end); break;
-        case Variant::Type::UInt16: toChars<UInt16>(variant, str, end); break;
-        case Variant::Type::Int32: toChars<Int32>(variant, str, end); break;
-        case Variant::Type::UInt32: toChars<UInt32>(variant, str, end); break;
-        case Variant::Type::Int64: toChars<Int64>(variant, str, end); break;
-        case Variant::Type::UInt64: toChars<UInt64>(variant, str, end); break;
+        case Variant::Type::I8Vector: toCharsVector<I8Vector>(variant, dim.first, data); break;
+        case Variant::Type::UI8Vector: toCharsVector<UI8Vector>(variant, dim.first, data); break;
+        case Variant::Type::I16Vector: toCharsVector<I16Vector>(variant, dim.first, data); break;
+        case Variant::Type::UI16Vector: toCharsVector<UI16Vector>(variant, dim.first, data); break;
+        case Variant::Type::I32Vector: toCharsVector<I32Vector>(variant, dim.first, data); break;
+        case Variant::Type::UI32Vector: toCharsVector<UI32Vector>(variant, dim.first, data); break;
+        case Variant::Type::I64Vector: toCharsVector<I64Vector>(variant, dim.first, data); break;
+        case Variant::Type::UI64Vector: toCharsVector<UI64Vector>(variant, dim.first, data); break;
+        case Variant::Type::F32Vector: toCharsVector<F32Vector>(variant, dim.first, data); break;
+        case Variant::Type::F64Vector: toCharsVector<F64Vector>(variant, dim.first, data); break;
+        case Variant::Type::C32Vector: toCharsVector<C32Vector>(variant, dim.first, data); break;
+        case Variant::Type::C64Vector: toCharsVector<C64Vector>(variant, dim.first, data); break;
         default: break;
         }
-        node.append_attribute("value").set_value(str);
-    }
-    else if(variant.type() == Variant::Type::Float32)
-        node.append_attribute("value").set_value(variant.value<Float32>());
-    else if(variant.type() == Variant::Type::Float64)
-        node.append_attribute("value").set_value(variant.value<Float64>());
-    else if(variant.type() == Variant::Type::Complex32 || variant.type() == Variant::Type::Complex64)
-    {
-        std::string str;
-        if(variant.type() == Variant::Type::Complex32)
-            toCharsComplex<Complex32>(variant, str);
-        else
-            toCharsComplex<Complex64>(variant, str);
-        node.append_attribute("value").set_value(str.c_str());
+        return true;
     }
-    else if(variant.type() >= Variant::Type::I8Vector && variant.type() <= Variant::Type::C64Vector)
+    else if(variant.type() >= Variant::Type::I8Matrix && variant.type() <= Variant::Type::C64Matrix)
     {
-        size_t len = 0;
-        ByteArray data;
         switch(variant.type())
         {
-        case Variant::Type::I8Vector: toCharsVector<I8Vector>(variant, len, data); break;
-        case Variant::Type::UI8Vector: toCharsVector<UI8Vector>(variant, len, data); break;
-        case Variant::Type::I16Vector: toCharsVector<I16Vector>(variant, len, data); break;
-        case Variant::Type::UI16Vector: toCharsVector<UI16Vector>(variant, len, data); break;
-        case Variant::Type::I32Vector: toCharsVector<I32Vector>(variant, len, data); break;
-        case Variant::Type::UI32Vector: toCharsVector<UI32Vector>(variant, len, data); break;
-        case Variant::Type::I64Vector: toCharsVector<I64Vector>(variant, len, data); break;
-        case Variant::Type::UI64Vector: toCharsVector<UI64Vector>(variant, len, data); break;
-        case Variant::Type::F32Vector: toCharsVector<F32Vector>(variant, len, data); break;
-        case Variant::Type::F64Vector: toCharsVector<F64Vector>(variant, len, data); break;
-        case Variant::Type::C32Vector: toCharsVector<C32Vector>(variant, len, data); break;
-        case Variant::Type::C64Vector: toCharsVector<C64Vector>(variant, len, data); break;
+        case Variant::Type::I8Matrix: toCharsMatrix<I8Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::UI8Matrix: toCharsMatrix<UI8Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::I16Matrix: toCharsMatrix<I16Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::UI16Matrix: toCharsMatrix<UI16Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::I32Matrix: toCharsMatrix<I32Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::UI32Matrix: toCharsMatrix<UI32Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::I64Matrix: toCharsMatrix<I64Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::UI64Matrix: toCharsMatrix<UI64Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::F32Matrix: toCharsMatrix<F32Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::F64Matrix: toCharsMatrix<F64Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::C32Matrix: toCharsMatrix<C32Matrix>(variant, dim.first, dim.second, data); break;
+        case Variant::Type::C64Matrix: toCharsMatrix<C64Matrix>(variant, dim.first, dim.second, data); break;
         default: break;
         }
-        node.append_attribute("length").set_value(len);
-        node.append_attribute("location").set_value("inline:base64");
-        node.append_child(pugi::node_pcdata).set_value(data.constData());
+        return true;
     }
-    else if(variant.type() >= Variant::Type::I8Matrix && variant.type() <= Variant::Type::C64Matrix)
+    return false;
+}
+
+/** Write length or rows and columns attributes of vector or matrix property */
+void serializeVariantDimensions(XmlWriter &xml, Variant::Type type, std::pair<size_t, size_t> dim)
+{
+    if(type >= Variant::Type::I8Vector && type <= Variant::Type::C64Vector)
     {
-        size_t rows = 0;
-        size_t cols = 0;
-        ByteArray data;
-        switch(variant.type())
-        {
-        case Variant::Type::I8Matrix: toCharsMatrix<I8Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI8Matrix: toCharsMatrix<UI8Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I16Matrix: toCharsMatrix<I16Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI16Matrix: toCharsMatrix<UI16Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I32Matrix: toCharsMatrix<I32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI32Matrix: toCharsMatrix<UI32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::I64Matrix: toCharsMatrix<I64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::UI64Matrix: toCharsMatrix<UI64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::F32Matrix: toCharsMatrix<F32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::F64Matrix: toCharsMatrix<F64Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::C32Matrix: toCharsMatrix<C32Matrix>(variant, rows, cols, data); break;
-        case Variant::Type::C64Matrix: toCharsMatrix<C64Matrix>(variant, rows, cols, data); break;
-        default: break;
-        }
+        xml.attribute("length", (uint64_t)dim.first);
+    }
+    else
+    {
+        xml.attribute("rows", (uint64_t)dim.first);
+        xml.attribute("columns", (uint64_t)dim.second);
+    }
+}
 
-        node.append_attribute("rows").set_value(rows);
-        node.append_attribute("columns").set_value(cols);
-        node.append_attribute("location").set_value("inline:base64");
-        node.append_child(pugi::node_pcdata).set_value(data.constData());
+/** Write type, value and comment attributes of Property element followed by its content */
+void serializeVariant(XmlWriter &xml, const Variant &variant, const String &comment)
+{
+    char str[scalarBufferSize];
+    std::string_view text;
+    ByteArray data;
+    std::pair<size_t, size_t> dim;
+
+    xml.attribute("type", variant.typeName());
+
+    if(variant.type() == Variant::Type::String)
+    {
+        text = variant.value<String>();
+    }
+    else if(char *end = formatScalar(variant, str, str + sizeof(str)))
+    {
+        xml.attribute("value", std::string_view(str, end - str));
     }
-    else if(variant.type() == Variant::Type::TimePoint)
+    else if(serializeVariant(variant, dim, data))
     {
-        std::ostringstream ss;
-        ss << std::put_time(&variant.value<TimePoint>(), "%Y-%m-%dT%H:%M:%SZ");
-        node.append_attribute("value").set_value(ss.str().c_str());
+        data.encodeBase64();
+        serializeVariantDimensions(xml, variant.type(), dim);
+        xml.attribute("location", "inline:base64");
+        text = std::string_view(data.constData(), data.size());
     }
+
+    if(!comment.empty())
+        xml.attribute("comment", comment);
+    if(!text.empty())
+        xml.text(text);
 }
+
+
 Variant variantFromString(Variant::Type type, const String &str)
 {
     Variant variant;
     switch(type)
     {
     case Variant::Type::Int32: variant = fromChars<Int32>(str.c_str(), str.c_str() + str.size()); break;
-    case Variant::Type::Float32: variant = std::stof(str); break;
-    case Variant::Type::Float64: variant = std::stod(str); break;
+    case Variant::Type::Float32: variant = fromChars<Float32>(str.c_str(), str.c_str() + str.size()); break;
+    case Variant::Type::Float64: variant = fromChars<Float64>(str.c_str(), str.c_str() + str.size()); break;
     case Variant::Type::String: variant = str; break;
     case Variant::Type::TimePoint:
     {
-        std::istringstream ss(str);
         std::tm tm = {};
-        ss >> std::get_time(&tm, "%Y-%m-%dT%H:%M:%SZ");
+        if(!parseTimePoint(str, tm))
+            tm = {};
         variant = tm;
         break;
     }
@@ -401,6 +618,53 @@ Variant variantFromString(Variant::Type type, const String &str)
     return variant;
 }
 
+struct Variant::Loader
+{
+    std::once_flag once;
+    std::function<Variant()> load;
+    StdVariant value;
+    std::atomic<bool> loaded{false};
+};
+
+/** Load deferred value once, loader is shared between copies so they don't read same data again */
+const Variant::StdVariant& Variant::resolve() const
+{
+    Loader &loader = *_loader;
+    std::call_once(loader.once, [&loader]()
+    {
+        Variant variant = loader.load();
+        variant.takeLoaded();
+        loader.value = std::move(variant._value);
+        loader.load = nullptr;
+        loader.loaded = true;
+    });
+    return loader.value;
+}
+
+/** Move loaded value into this Variant so it can be modified */
+void Variant::takeLoaded()
+{
+    if(!_loader)
+        return;
+    resolve();
+    if(_loader.use_count() == 1)
+        _value = std::move(_loader->value);
+    else
+        _value = _loader->value;
+    _loader = nullptr;
+}
+
+void Variant::setLoader(const std::function<Variant()> &loader)
+{
+    _loader = std::make_shared<Loader>();
+    _loader->load = loader;
+}
+
+bool Variant::isLoaded() const
+{
+    return !_loader || _loader->loaded;
+}
+
 Variant::Type Variant::type() const
 {
     int idx = _value.index();
@@ -409,97 +673,25 @@ Variant::Type Variant::type() const
 
 const char* Variant::typeName() const
 {
-    if(idToType.count(type()))
-        return idToType[type()];
-    else
-        return "";
+    size_t index = (size_t)type();
+    return index < typeCount ? typeNames[index].data() : "";
 }
 
 String Variant::toString() const
 {
-    std::string string;
-    char str[32] = {0};
-    char *end = str + sizeof(str);
+    const StdVariant &resolved = _loader ? resolve() : _value;
 
-    auto vectorString = [](auto &vector) {
-        std::stringstream ss;
-        ss << "{";
-        for(auto &i : vector)
-        {
-            ss << i;
-            if(i != vector.back())
-                ss << ",";
-        }
-        ss << "}";
-        return ss.str();
-    };
+    char str[scalarBufferSize];
+    if(char *end = formatScalar(*this, str, str + sizeof(str)))
+        return String(str, end);
 
-    auto matrixString = [](auto matrix) {
-        std::stringstream ss;
-        ss << "{";
-        for(int i=0; i<matrix.rows(); i++)
-        {
-            ss << "{";
-            for(int o=0; o<matrix.cols(); o++)
-            {
-#if __GNUC__ >= 11 || __clang__
-                char str[128] = {0};
-                char *end = str + sizeof(str);
-                std::to_chars(str, end, matrix(i, o));
-                ss << str;
-#else
-                ss << std::to_string(matrix(i, o));
-#endif
-                if(o < matrix.cols() - 1)
-                    ss << ",";
-            }
-            ss << "}";
-            if(i < matrix.rows() - 1)
-                ss << ",";
-        }
-        return ss.str();
-    };
-
-    switch(type())
-    {
-    case Variant::Type::Int8: toChars<Int8>(_value, str, end); break;
-    case Variant::Type::UInt8: toChars<UInt8>(_value, str, end); break;
-    case Variant::Type::Int16: toChars<Int16>(_value, str, end); break;
-    case Variant::Type::UInt16: toChars<UInt16>(_value, str, end); break;
-    case Variant::Type::Int32: toChars<Int32>(_value, str, end); break;
-    case Variant::Type::UInt32: toChars<UInt32>(_value, str, end); break;
-    case Variant::Type::Int64: toChars<Int64>(_value, str, end); break;
-    case Variant::Type::UInt64: toChars<UInt64>(_value, str, end); break;
-    case Variant::Type::Float32: string = std::to_string(std::get<Float32>(_value)); break;
-    case Variant::Type::Float64: string = std::to_string(std::get<Float64>(_value)); break;
-    case Variant::Type::Complex32: toCharsComplex<Complex32>(_value, string); break;
-    case Variant::Type::Complex64: toCharsComplex<Complex64>(_value, string); break;
-    case Variant::Type::I8Vector: string = vectorString(std::get<I8Vector>(_value)); break;
-    case Variant::Type::UI8Vector: string = vectorString(std::get<UI8Vector>(_value)); break;
-    case Variant::Type::I16Vector: string = vectorString(std::get<I16Vector>(_value)); break;
-    case Variant::Type::UI16Vector: string = vectorString(std::get<UI16Vector>(_value)); break;
-    case Variant::Type::I32Vector: string = vectorString(std::get<I32Vector>(_value)); break;
-    case Variant::Type::UI32Vector: string = vectorString(std::get<UI32Vector>(_value)); break;
-    case Variant::Type::I64Vector: string = vectorString(std::get<I64Vector>(_value)); break;
-    case Variant::Type::UI64Vector: string = vectorString(std::get<UI64Vector>(_value)); break;
-    case Variant::Type::F32Vector: string = vectorString(std::get<F32Vector>(_value)); break;
-    case Variant::Type::F64Vector: string = vectorString(std::get<F64Vector>(_value)); break;
-    case Variant::Type::F32Matrix: string = matrixString(std::get<F32Matrix>(_value)); break;
-    case Variant::Type::F64Matrix: string = matrixString(std::get<F64Matrix>(_value)); break;
-    case Variant::Type::String: string = std::get<String>(_value); break;
-    case Variant::Type::TimePoint:
-    {
-        std::ostringstream ss;
-        ss << std::put_time(&std::get<TimePoint>(_value), "%Y-%m-%dT%H:%M:%SZ");
-        string = ss.str();
-        break;
-    }
-    default: string = typeName(); break;
-    }
-
-    if(type() >= Variant::Type::Int8 && type() <= Variant::Type::UInt64)
-        string = str;
+    if(type() == Variant::Type::Monostate)
+        return typeName();
+    if(type() == Variant::Type::String)
+        return std::get<String>(resolved);
 
+    std::string string;
+    std::visit([&string](auto &value){ appendString(string, value); }, resolved);
     return string;
 }
 
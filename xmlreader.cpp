@@ -0,0 +1,492 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "xmlreader.h"
+#include "libxisf.h"
+#include <charconv>
+#include <cstring>
+
+namespace LibXISF
+{
+
+enum CharClass : uint8_t
+{
+    Space = 1,
+    NameEnd = 2,
+    AttributeEscape = 4,// characters that need decoding in attribute values
+    TextEscape = 8
+};
+
+static const struct CharTable
+{
+    uint8_t table[256] = {0};
+    CharTable()
+    {
+        for(unsigned char c : {' ', '\t', '\n', '\r'})
+            table[c] |= Space | NameEnd;
+        for(unsigned char c : {'>', '/', '='})
+            table[c] |= NameEnd;
+        for(unsigned char c : {'&', '\t', '\n', '\r'})
+            table[c] |= AttributeEscape;
+        for(unsigned char c : {'&', '\r'})
+            table[c] |= TextEscape;
+    }
+    uint8_t operator[](char c) const { return table[(unsigned char)c]; }
+} charClass;
+
+static inline bool isSpace(char c)
+{
+    return charClass[c] & Space;
+}
+
+static inline bool isNameEnd(char c)
+{
+    return charClass[c] & NameEnd;
+}
+
+/** Return position of first character of given class or size when there is none */
+static inline size_t findClass(std::string_view str, size_t pos, uint8_t mask)
+{
+    while(pos < str.size() && !(charClass[str[pos]] & mask))
+        pos++;
+    return pos;
+}
+
+static void appendUtf8(std::string &out, uint32_t c)
+{
+    if(c < 0x80)
+        out.push_back(c);
+    else if(c < 0x800)
+    {
+        out.push_back(0xc0 | c >> 6);
+        out.push_back(0x80 | (c & 0x3f));
+    }
+    else if(c < 0x10000)
+    {
+        out.push_back(0xe0 | c >> 12);
+        out.push_back(0x80 | (c >> 6 & 0x3f));
+        out.push_back(0x80 | (c & 0x3f));
+    }
+    else
+    {
+        out.push_back(0xf0 | c >> 18);
+        out.push_back(0x80 | (c >> 12 & 0x3f));
+        out.push_back(0x80 | (c >> 6 & 0x3f));
+        out.push_back(0x80 | (c & 0x3f));
+    }
+}
+
+XmlReader::XmlReader(const char *begin, const char *end) :
+    _begin(begin),
+    _end(end),
+    _pos(begin),
+    _tokenStart(begin)
+{
+    // UTF-8 byte order mark
+    if(_end - _pos >= 3 && std::memcmp(_pos, "\xef\xbb\xbf", 3) == 0)
+        _pos += 3;
+}
+
+void XmlReader::error()
+{
+    throw Error("Malformed XML header at offset " + std::to_string(_pos - _begin));
+}
+
+std::string_view XmlReader::attribute(std::string_view name) const
+{
+    for(auto &attr : _attributes)
+        if(attr.name == name)
+            return attr.value;
+    return std::string_view();
+}
+
+bool XmlReader::hasAttribute(std::string_view name) const
+{
+    for(auto &attr : _attributes)
+        if(attr.name == name)
+            return true;
+    return false;
+}
+
+void XmlReader::skipPast(const char *str)
+{
+    size_t len = std::strlen(str);
+    while(_pos + len <= _end)
+    {
+        const char *p = static_cast<const char*>(std::memchr(_pos, str[0], _end - _pos));
+        if(!p || p + len > _end)
+            break;
+        if(std::memcmp(p, str, len) == 0)
+        {
+            _pos = p + len;
+            return;
+        }
+        _pos = p + 1;
+    }
+    error();
+}
+
+void XmlReader::decode(std::string_view raw, std::string &out, bool attribute)
+{
+    size_t i = 0;
+    while(i < raw.size())
+    {
+        // copy plain characters in one go
+        size_t special = findClass(raw, i, attribute ? AttributeEscape : TextEscape);
+        out.append(raw.data() + i, special - i);
+        i = special;
+        if(i >= raw.size())
+            break;
+
+        char c = raw[i++];
+        if(c == '&')
+        {
+            size_t semicolon = raw.find(';', i);
+            if(semicolon == std::string_view::npos)
+            {
+                out.push_back(c);
+                continue;
+            }
+            std::string_view entity = raw.substr(i, semicolon - i);
+            if(entity == "lt")out.push_back('<');
+            else if(entity == "gt")out.push_back('>');
+            else if(entity == "amp")out.push_back('&');
+            else if(entity == "quot")out.push_back('"');
+            else if(entity == "apos")out.push_back('\'');
+            else if(entity.size() > 1 && entity[0] == '#')
+            {
+                bool hex = entity[1] == 'x';
+                uint32_t code = 0;
+                std::from_chars(entity.data() + (hex ? 2 : 1), entity.data() + entity.size(), code, hex ? 16 : 10);
+                appendUtf8(out, code);
+            }
+            else
+            {
+                out.append(raw.substr(i - 1, semicolon - i + 2));
+            }
+            i = semicolon + 1;
+        }
+        else if(c == '\r')
+        {
+            // end of line normalization
+            if(i < raw.size() && raw[i] == '\n')
+                i++;
+            out.push_back(attribute ? ' ' : '\n');
+        }
+        else
+        {
+            out.push_back(' ');
+        }
+    }
+}
+
+void XmlReader::parseText(const char *end)
+{
+    std::string_view raw(_pos, end - _pos);
+    _pos = end;
+    if(findClass(raw, 0, TextEscape) == raw.size())
+    {
+        _text = raw;
+    }
+    else
+    {
+        _textStorage.clear();
+        decode(raw, _textStorage, false);
+        _text = _textStorage;
+    }
+}
+
+void XmlReader::parseStartTag()
+{
+    // values are stored as offsets until tag is finished because storage may reallocate
+    std::vector<RawAttribute> &raw = _rawAttributes;
+    raw.clear();
+    _attributes.clear();
+    _attributeStorage.clear();
+
+    const char *nameStart = ++_pos;
+    while(_pos < _end && !isNameEnd(*_pos))_pos++;
+    _name = std::string_view(nameStart, _pos - nameStart);
+    if(_name.empty())
+        error();
+
+    while(true)
+    {
+        while(_pos < _end && isSpace(*_pos))_pos++;
+        if(_pos >= _end)
+            error();
+
+        if(*_pos == '>')
+        {
+            _pos++;
+            break;
+        }
+        if(*_pos == '/')
+        {
+            if(_pos + 1 >= _end || _pos[1] != '>')
+                error();
+            _pos += 2;
+            _pendingEnd = true;
+            break;
+        }
+
+        const char *attrStart = _pos;
+        while(_pos < _end && !isNameEnd(*_pos))_pos++;
+        std::string_view attrName(attrStart, _pos - attrStart);
+        while(_pos < _end && isSpace(*_pos))_pos++;
+        if(attrName.empty() || _pos >= _end || *_pos != '=')
+            error();
+        _pos++;
+        while(_pos < _end && isSpace(*_pos))_pos++;
+        if(_pos >= _end || (*_pos != '"' && *_pos != '\''))
+            error();
+
+        char quote = *_pos++;
+        const char *valueEnd = _pos;
+        uint8_t escape = 0;
+        while(valueEnd < _end && *valueEnd != quote)
+            escape |= charClass[*valueEnd++];
+        if(valueEnd >= _end)
+            error();
+
+        std::string_view value(_pos, valueEnd - _pos);
+        if(!(escape & AttributeEscape))
+        {
+            raw.push_back({attrName, value.data(), 0, value.size()});
+        }
+        else
+        {
+            size_t offset = _attributeStorage.size();
+            decode(value, _attributeStorage, true);
+            raw.push_back({attrName, nullptr, offset, _attributeStorage.size() - offset});
+        }
+        _pos = valueEnd + 1;
+    }
+
+    for(auto &attr : raw)
+    {
+        const char *ptr = attr.ptr ? attr.ptr : _attributeStorage.data() + attr.offset;
+        _attributes.push_back({attr.name, std::string_view(ptr, attr.size)});
+    }
+}
+
+XmlReader::Token XmlReader::next()
+{
+    if(_pendingEnd)
+    {
+        _pendingEnd = false;
+        _attributes.clear();
+        _tokenStart = _pos;
+        return _token = EndElement;
+    }
+
+    while(_pos < _end)
+    {
+        _tokenStart = _pos;
+        if(*_pos != '<')
+        {
+            const char *lt = static_cast<const char*>(std::memchr(_pos, '<', _end - _pos));
+            if(!lt)
+                lt = _end;
+
+            const char *p = _pos;
+            while(p < lt && isSpace(*p))p++;
+            if(p == lt)
+            {
+                _pos = lt;
+                continue;
+            }
+            parseText(lt);
+            return _token = Text;
+        }
+
+        if(_end - _pos >= 2 && _pos[1] == '?')
+        {
+            skipPast("?>");
+        }
+        else if(_end - _pos >= 4 && std::memcmp(_pos, "<!--", 4) == 0)
+        {
+            _pos += 4;
+            skipPast("-->");
+        }
+        else if(_end - _pos >= 9 && std::memcmp(_pos, "<![CDATA[", 9) == 0)
+        {
+            const char *start = _pos + 9;
+            _pos = start;
+            skipPast("]]>");
+            _text = std::string_view(start, _pos - 3 - start);
+            return _token = Text;
+        }
+        else if(_end - _pos >= 2 && _pos[1] == '!')
+        {
+            // DOCTYPE may contain internal subset in brackets
+            int depth = 0;
+            for(_pos += 2; _pos < _end; _pos++)
+            {
+                if(*_pos == '[')depth++;
+                else if(*_pos == ']')depth--;
+                else if(*_pos == '>' && depth <= 0)break;
+            }
+            if(_pos >= _end)
+                error();
+            _pos++;
+        }
+        else if(_end - _pos >= 2 && _pos[1] == '/')
+        {
+            const char *nameStart = _pos + 2;
+            const char *gt = static_cast<const char*>(std::memchr(nameStart, '>', _end - nameStart));
+            if(!gt)
+                error();
+            const char *nameEnd = nameStart;
+            while(nameEnd < gt && !isSpace(*nameEnd))nameEnd++;
+            _name = std::string_view(nameStart, nameEnd - nameStart);
+            _attributes.clear();
+            _pos = gt + 1;
+            return _token = EndElement;
+        }
+        else
+        {
+            parseStartTag();
+            return _token = StartElement;
+        }
+    }
+
+    _tokenStart = _pos;
+    return _token = EndDocument;
+}
+
+bool XmlReader::nextChild()
+{
+    Token token = next();
+    if(token == EndDocument)
+        error();
+    return token != EndElement;
+}
+
+void XmlReader::skipElement()
+{
+    if(_pendingEnd)
+    {
+        next();
+        return;
+    }
+
+    // only tag boundaries are located here, attributes and text are not parsed
+    int depth = 1;
+    while(true)
+    {
+        const char *lt = static_cast<const char*>(std::memchr(_pos, '<', _end - _pos));
+        if(!lt || lt + 1 >= _end)
+            error();
+        _pos = lt;
+
+        if(lt[1] == '/')
+        {
+            if(--depth == 0)
+            {
+                next();
+                return;
+            }
+            const char *gt = static_cast<const char*>(std::memchr(lt, '>', _end - lt));
+            if(!gt)
+                error();
+            _pos = gt + 1;
+        }
+        else if(lt[1] == '?')
+        {
+            _pos = lt + 2;
+            skipPast("?>");
+        }
+        else if(_end - lt >= 4 && std::memcmp(lt, "<!--", 4) == 0)
+        {
+            _pos = lt + 4;
+            skipPast("-->");
+        }
+        else if(_end - lt >= 9 && std::memcmp(lt, "<![CDATA[", 9) == 0)
+        {
+            _pos = lt + 9;
+            skipPast("]]>");
+        }
+        else if(lt[1] == '!')
+        {
+            _pos = lt + 2;
+            skipPast(">");
+        }
+        else
+        {
+            const char *p = lt + 1;
+            while(p < _end && *p != '>')
+            {
+                if(*p == '"' || *p == '\'')
+                {
+                    p = static_cast<const char*>(std::memchr(p + 1, *p, _end - p - 1));
+                    if(!p)
+                        error();
+                }
+                p++;
+            }
+            if(p >= _end)
+                error();
+            if(p[-1] != '/')
+                depth++;
+            _pos = p + 1;
+        }
+    }
+}
+
+std::string_view XmlReader::readText()
+{
+    std::string_view text;
+    bool collected = false;
+    int depth = 1;
+    while(depth > 0)
+    {
+        switch(next())
+        {
+        case StartElement: depth++; break;
+        case EndElement: depth--; break;
+        case Text:
+            if(depth != 1)
+                break;
+            if(text.empty() && !collected)
+            {
+                text = _text;
+                // view may point into storage that is overwritten by next text token
+                if(_text.data() == _textStorage.data())
+                {
+                    _collectedText.assign(_text);
+                    text = _collectedText;
+                    collected = true;
+                }
+            }
+            else
+            {
+                if(!collected)
+                    _collectedText.assign(text);
+                _collectedText.append(_text);
+                text = _collectedText;
+                collected = true;
+            }
+            break;
+        case EndDocument: error();
+        }
+    }
+    return text;
+}
+
+}
@@ -0,0 +1,104 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#ifndef XMLREADER_H
+#define XMLREADER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace LibXISF
+{
+
+/** Pull parser for XISF headers. It walks buffer in single pass without building DOM tree.
+ *  Names, attribute values and text are returned as views into buffer, only values containing
+ *  entity references or line breaks are decoded into internal storage. Views stay valid until next call of next().
+ *  Comments, processing instructions and DOCTYPE are skipped, CDATA sections are returned as text.
+ *  Whitespace only text is skipped. Malformed input throw Error. */
+class XmlReader
+{
+public:
+    enum Token
+    {
+        StartElement,
+        EndElement,
+        Text,
+        EndDocument
+    };
+    struct Attribute
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    XmlReader(const char *begin, const char *end);
+    Token next();
+    /** Advance to next child element or text of current element. Return false when its end tag is reached */
+    bool nextChild();
+    Token token() const { return _token; }
+    /** Name of current start or end element */
+    std::string_view name() const { return _name; }
+    /** Content of current text token */
+    std::string_view text() const { return _text; }
+    /** Attributes of current start element */
+    const std::vector<Attribute>& attributes() const { return _attributes; }
+    /** Return attribute value or empty string when it is missing */
+    std::string_view attribute(std::string_view name) const;
+    bool hasAttribute(std::string_view name) const;
+    /** Skip content of current start element including its end tag */
+    void skipElement();
+    /** Return text content of current start element and move past its end tag. Child elements are skipped */
+    std::string_view readText();
+    /** Offset of beginning of current token */
+    size_t tokenOffset() const { return _tokenStart - _begin; }
+    /** Offset just after current token */
+    size_t offset() const { return _pos - _begin; }
+private:
+    struct RawAttribute
+    {
+        std::string_view name;
+        const char *ptr;
+        size_t offset;
+        size_t size;
+    };
+
+    void parseStartTag();
+    void parseText(const char *end);
+    void skipPast(const char *str);
+    void decode(std::string_view raw, std::string &out, bool attribute);
+    [[noreturn]] void error();
+
+    const char *_begin;
+    const char *_end;
+    const char *_pos;
+    const char *_tokenStart;
+    Token _token = EndDocument;
+    bool _pendingEnd = false;
+    std::string_view _name;
+    std::string_view _text;
+    std::vector<Attribute> _attributes;
+    std::vector<RawAttribute> _rawAttributes;
+    std::string _attributeStorage;
+    std::string _textStorage;
+    std::string _collectedText;
+};
+
+}
+
+#endif // XMLREADER_H
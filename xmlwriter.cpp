@@ -0,0 +1,142 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#include "xmlwriter.h"
+#include <charconv>
+
+namespace LibXISF
+{
+
+void XmlWriter::raw(std::string_view text)
+{
+    _out.append(text.data(), text.size());
+}
+
+void XmlWriter::comment(std::string_view text)
+{
+    closeStartTag();
+    _out += "<!--";
+    raw(text);
+    _out += "-->";
+}
+
+void XmlWriter::startElement(std::string_view name)
+{
+    closeStartTag();
+    _out += '<';
+    raw(name);
+    _elements.push_back(name);
+    _startTagOpen = true;
+}
+
+void XmlWriter::attribute(std::string_view name, std::string_view value)
+{
+    startAttribute(name);
+    escape(value, true);
+    endAttribute();
+}
+
+void XmlWriter::attribute(std::string_view name, uint64_t value)
+{
+    char str[24];
+    startAttribute(name);
+    raw(std::string_view(str, std::to_chars(str, str + sizeof(str), value).ptr - str));
+    endAttribute();
+}
+
+void XmlWriter::startAttribute(std::string_view name)
+{
+    _out += ' ';
+    raw(name);
+    _out += "=\"";
+}
+
+void XmlWriter::endAttribute()
+{
+    _out += '"';
+}
+
+void XmlWriter::text(std::string_view text)
+{
+    closeStartTag();
+    escape(text, false);
+}
+
+void XmlWriter::endElement()
+{
+    if(_startTagOpen)
+    {
+        _out += "/>";
+        _startTagOpen = false;
+    }
+    else
+    {
+        _out += "</";
+        raw(_elements.back());
+        _out += '>';
+    }
+    _elements.pop_back();
+}
+
+void XmlWriter::closeStartTag()
+{
+    if(_startTagOpen)
+    {
+        _out += '>';
+        _startTagOpen = false;
+    }
+}
+
+void XmlWriter::escape(std::string_view text, bool attribute)
+{
+    size_t start = 0;
+    for(size_t i = 0; i < text.size(); i++)
+    {
+        const char *replacement = nullptr;
+        char control[6] = "&#00;";
+        switch(text[i])
+        {
+        case '&': replacement = "&amp;"; break;
+        case '<': replacement = "&lt;"; break;
+        case '>': replacement = attribute ? nullptr : "&gt;"; break;
+        case '"': replacement = attribute ? "&quot;" : nullptr; break;
+        case '\t': replacement = attribute ? "&#09;" : nullptr; break;
+        case '\n': replacement = attribute ? "&#10;" : nullptr; break;
+        case '\r': replacement = "&#13;"; break;
+        default:
+            // other control characters are written as two digit character reference like pugixml does
+            if((unsigned char)text[i] < 0x20)
+            {
+                control[2] = '0' + text[i] / 10;
+                control[3] = '0' + text[i] % 10;
+                replacement = control;
+            }
+            break;
+        }
+
+        if(replacement)
+        {
+            _out.append(text.data() + start, i - start);
+            _out += replacement;
+            start = i + 1;
+        }
+    }
+    _out.append(text.data() + start, text.size() - start);
+}
+
+}
@@ -0,0 +1,61 @@
+/************************************************************************
+ * LibXISF - library to load and save XISF files                        *
+ * Copyright (C) 2025 Dušan Poizl                                       *
+ *                                                                      *
+ * This program is free software: you can redistribute it and/or modify *
+ * it under the terms of the GNU General Public License as published by *
+ * the Free Software Foundation, either version 3 of the License, or    *
+ * (at your option) any later version.                                  *
+ *                                                                      *
+ * This program is distributed in the hope that it will be useful,      *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of       *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        *
+ * GNU General Public License for more details.                         *
+ *                                                                      *
+ * You should have received a copy of the GNU General Public License    *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.*
+ ************************************************************************/
+
+#ifndef XMLWRITER_H
+#define XMLWRITER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace LibXISF
+{
+
+/** Streaming writer of XISF headers. Markup is appended directly to output string without building DOM tree.
+ *  Element names must stay valid until their end tag is written. Escaping matches pugixml so output is same
+ *  as before. */
+class XmlWriter
+{
+public:
+    explicit XmlWriter(std::string &out) : _out(out) {}
+    /** Append text without any escaping */
+    void raw(std::string_view text);
+    void comment(std::string_view text);
+    void startElement(std::string_view name);
+    void attribute(std::string_view name, std::string_view value);
+    void attribute(std::string_view name, uint64_t value);
+    /** Start attribute whose value is appended by raw(). It must not contain characters that need escaping */
+    void startAttribute(std::string_view name);
+    void endAttribute();
+    void text(std::string_view text);
+    /** Close current element, element without content is written as empty element tag */
+    void endElement();
+    std::string &buffer() { return _out; }
+private:
+    void closeStartTag();
+    void escape(std::string_view text, bool attribute);
+
+    std::string &_out;
+    std::vector<std::string_view> _elements;
+    bool _startTagOpen = false;
+};
+
+}
+
+#endif // XMLWRITER_H